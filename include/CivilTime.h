@@ -0,0 +1,19 @@
+#ifndef _CIVIL_TIME_H_INCLUDED
+#define _CIVIL_TIME_H_INCLUDED
+
+#include <stdint.h>
+
+//seconds since 1970-01-01 00:00:00 for a proleptic Gregorian date, integer arithmetic only
+//(days_from_civil, see http://howardhinnant.github.io/date_algorithms.html)
+inline uint32_t civilToEpoch(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second)
+{
+    int32_t y = year - (month <= 2);
+    int32_t era = (y >= 0 ? y : y - 399) / 400;
+    uint32_t yoe = static_cast<uint32_t>(y - era * 400);
+    uint32_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int32_t days = era * 146097 + static_cast<int32_t>(doe) - 719468;
+    return static_cast<uint32_t>(days) * 86400UL + hour * 3600UL + minute * 60UL + second;
+}
+
+#endif
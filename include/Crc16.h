@@ -0,0 +1,24 @@
+#ifndef _CRC16_H_INCLUDED
+#define _CRC16_H_INCLUDED
+
+#include <stdint.h>
+
+//CRC-16/CCITT-FALSE, start from 0xFFFF
+inline uint16_t crc16(uint16_t crc, uint8_t c)
+{
+    crc ^= (uint16_t) c << 8;
+    for (uint8_t i = 0; i < 8; i++){
+        crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+inline uint16_t crc16(uint16_t crc, const uint8_t* data, uint16_t len)
+{
+    while (len--){
+        crc = crc16(crc, *data++);
+    }
+    return crc;
+}
+
+#endif
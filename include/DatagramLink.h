@@ -0,0 +1,54 @@
+#ifndef _DATAGRAM_LINK_H_INCLUDED
+#define _DATAGRAM_LINK_H_INCLUDED
+
+#include "GPRS.h"
+
+#define DATAGRAM_MAGIC 0xA9
+#define DATAGRAM_HEADER_SIZE 4
+#define DATAGRAM_DATA 0x01
+#define DATAGRAM_ACK 0x02
+//wait for the first ack, doubled at each retransmission
+#ifndef DATAGRAM_ACK_TIMEOUT_MS
+#define DATAGRAM_ACK_TIMEOUT_MS 2000
+#endif
+#ifndef DATAGRAM_RETRIES
+#define DATAGRAM_RETRIES 4
+#endif
+
+/*At-least-once delivery over a UDP mux (GPRS::connect() with Protocol::UDP), stop and wait.
+
+    Every datagram starts with a header: DATAGRAM_MAGIC, DATAGRAM_DATA, a 16 bit sequence
+    number (big endian), then the payload. The peer answers each one with the header alone,
+    type DATAGRAM_ACK and the same sequence number; an ack that does not come back in time
+    makes the datagram go again, with the same sequence number. The peer can therefore see a
+    datagram more than once and must drop the sequence numbers it has already taken.
+
+    Acks are read from the socket buffer, where datagrams lose their boundaries: a frame is
+    found again from the magic byte, anything else received on the mux is discarded.
+*/
+class DatagramLink {
+
+public:
+    DatagramLink(GPRS& gprs);
+
+    /** Send a payload and wait for its ack
+      @param frame       DATAGRAM_HEADER_SIZE bytes of headroom, filled in here, then len bytes of payload
+      @return false if no ack came back after DATAGRAM_RETRIES retransmissions
+    */
+    bool send(uint8_t mux, uint8_t* frame, uint16_t len);
+    //sequence number of the next datagram
+    uint16_t sequence() const { return _sequence; }
+    uint32_t retransmits() const { return _retransmits; }
+
+private:
+    bool waitAck(uint8_t mux, uint16_t sequence, unsigned long timeout);
+
+    GPRS& _gprs;
+    uint16_t _sequence;
+    uint32_t _retransmits;
+    //header being received, may span several reads
+    uint8_t _rx[DATAGRAM_HEADER_SIZE];
+    uint8_t _rxLen;
+};
+
+#endif
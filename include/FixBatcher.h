@@ -0,0 +1,84 @@
+#ifndef _FIX_BATCHER_H_INCLUDED
+#define _FIX_BATCHER_H_INCLUDED
+
+#include "GSM.h"
+#include "GPRS.h"
+#include "DatagramLink.h"
+#include "PositionFix.h"
+#include "FlashLog.h"
+
+//fixes held in RAM waiting for the uplink
+#ifndef FIX_BATCH_SIZE
+#define FIX_BATCH_SIZE 16
+#endif
+//time before retrying a failed flush
+#ifndef FIX_BATCH_RETRY_MS
+#define FIX_BATCH_RETRY_MS (60 * 1000L)
+#endif
+#define FIX_BATCH_CONNECT_TIMEOUT_S 60
+//fixes per flash log record
+#define FIX_BATCH_LOG_FIXES 4
+
+/*Store-and-forward uplink: fixes are queued in RAM and sent together, in a single connection and
+    CIPSEND, once the batch reaches maxFixes or its oldest fix is maxAgeMs old. The modem is kept
+    in low power mode between flushes (ModemClass wakes it for each command).
+    Payloads use the delta/varint format of PositionCodec.h.
+
+    With a FlashLog attached, a failed flush moves the queued fixes to flash instead of keeping
+    them in RAM, so hours without coverage (or a reset) lose nothing; the next successful
+    connection drains the log in full payloads, oldest first, before the RAM queue.
+
+    Over UDP (setProtocol()) there is no connection handshake or teardown on the air: each payload
+    is a datagram sent through a DatagramLink, which retransmits it until the server acks it.
+*/
+class FixBatcher {
+
+public:
+    FixBatcher(GSM& gsm, GPRS& gprs);
+
+    void begin(const char* host, uint16_t port, uint8_t maxFixes = FIX_BATCH_SIZE, unsigned long maxAgeMs = 10 * 60 * 1000L);
+    //offline storage, FlashLog::begin() must have succeeded
+    void setLog(FlashLog* log) { _log = log; }
+    //Protocol::UDP sends acknowledged datagrams, see DatagramLink.h
+    void setProtocol(GPRS::Protocol protocol) { _protocol = protocol; }
+    const DatagramLink& link() const { return _link; }
+
+    /** Queue a fix
+      @return false if the batch was full and could not be flushed: the oldest fix was dropped
+    */
+    bool add(const PositionFix& fix);
+    bool add(float latitude, float longitude, long altitude, long accuracy, unsigned long timestamp);
+
+    /** Call from the main loop: flushes when a threshold is reached
+      @return true if a batch was sent
+    */
+    bool poll();
+    bool flush();
+    uint8_t pending() const { return _count; }
+    //fixes waiting in the flash log
+    bool stored() const { return _log != NULL && !_log->empty(); }
+
+private:
+    uint16_t encode(uint8_t* out, uint16_t size, uint8_t* encoded) const;
+    bool drain(uint8_t mux, uint8_t* payload, uint16_t size);
+    bool sendPayload(uint8_t mux, uint8_t* payload, uint16_t len);
+    bool spill();
+
+    GSM& _gsm;
+    GPRS& _gprs;
+    FlashLog* _log;
+    GPRS::Protocol _protocol;
+    DatagramLink _link;
+    const char* _host;
+    uint16_t _port;
+    uint8_t _maxFixes;
+    unsigned long _maxAgeMs;
+    PositionFix _fixes[FIX_BATCH_SIZE];
+    uint8_t _head;
+    uint8_t _count;
+    unsigned long _oldestMillis;
+    unsigned long _retryMillis;
+    bool _retry;
+};
+
+#endif
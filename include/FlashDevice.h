@@ -0,0 +1,30 @@
+#ifndef _FLASH_DEVICE_H_INCLUDED
+#define _FLASH_DEVICE_H_INCLUDED
+
+#include <stdint.h>
+
+/*NOR flash region as seen by FlashLog: programming can only clear bits, a page is programmed
+    at most once between erases and the erase unit is a row of several pages.
+    Addresses are offsets from the start of the region.
+*/
+class FlashDevice {
+
+public:
+    virtual ~FlashDevice() {}
+
+    //bytes, a multiple of rowSize()
+    virtual uint32_t size() const = 0;
+    virtual uint16_t pageSize() const = 0;
+    //erase unit, a multiple of pageSize()
+    virtual uint16_t rowSize() const = 0;
+
+    virtual void read(uint32_t address, void* data, uint16_t len) = 0;
+    /** Program part of one erased page
+      @return false if the page does not read back as written
+    */
+    virtual bool write(uint32_t address, const void* data, uint16_t len) = 0;
+    //erase the row containing address
+    virtual bool erase(uint32_t address) = 0;
+};
+
+#endif
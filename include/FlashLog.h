@@ -0,0 +1,89 @@
+#ifndef _FLASH_LOG_H_INCLUDED
+#define _FLASH_LOG_H_INCLUDED
+
+#include "FlashDevice.h"
+
+//largest page handled, the SAMD21 has 64 byte pages
+#ifndef FLASH_LOG_PAGE_MAX
+#define FLASH_LOG_PAGE_MAX 64
+#endif
+#define FLASH_LOG_HEADER_SIZE 12
+#define FLASH_LOG_PAYLOAD_MAX (FLASH_LOG_PAGE_MAX - FLASH_LOG_HEADER_SIZE)
+
+/*Append-only ring log in NOR flash, for data that must survive a reset while the uplink is down.
+
+    Every record takes one page: a header with its sequence number, the sequence number of the
+    oldest unconsumed record (tail) at write time, the payload length and a CRC-16, then the
+    payload. Records are written in order around the region and a row is erased as soon as the
+    head enters it, so all rows wear evenly and one row is always kept blank; when the log is
+    full the oldest row is lost.
+    Consumption is committed by trim(), which appends a record carrying the new tail, so no page
+    is ever programmed twice.
+
+    begin() finds the newest record from the first page of each row plus the pages of one row,
+    then the tail from the newest header. A page that fails its CRC (torn write) ends its row.
+*/
+class FlashLog {
+
+public:
+    FlashLog(FlashDevice& flash);
+
+    /** Scan the region for the head and tail of the log, formats it if nothing valid is found
+      @return false if the region is too small (less than two rows) or the pages too big
+    */
+    bool begin();
+    //erase the whole region
+    bool format();
+
+    /** Append a record
+      @return false if len exceeds payloadMax() or the page could not be programmed
+    */
+    bool append(const void* data, uint8_t len);
+
+    /** Next unconsumed record after the read cursor
+      @return payload length, -1 when the cursor reached the head
+    */
+    int read(void* data, uint8_t size);
+    //read cursor back to the tail
+    void rewind();
+    //everything before the read cursor is consumed
+    bool trim();
+
+    bool empty() const { return _tailSeq == _headSeq; }
+    uint8_t payloadMax() const { return _pageSize - FLASH_LOG_HEADER_SIZE; }
+    //records (data and trim) between tail and head
+    uint32_t records() const { return _headSeq - _tailSeq; }
+    //records lost because the log was full
+    uint32_t dropped() const { return _dropped; }
+
+private:
+    struct Header {
+        uint32_t seq;
+        uint32_t tail;
+        uint8_t len;
+        uint8_t type;
+        uint16_t crc;
+    };
+
+    bool readHeader(uint32_t address, Header* header, uint8_t* payload = 0);
+    bool isBlank(uint32_t address, uint16_t len);
+    bool appendRecord(uint8_t type, uint32_t tail, const void* data, uint8_t len);
+    void advance(uint32_t address);
+    void locateTail();
+    uint32_t nextPage(uint32_t address) const;
+    uint32_t nextRow(uint32_t address) const;
+
+    FlashDevice& _flash;
+    uint16_t _pageSize;
+    uint16_t _rowSize;
+    uint32_t _size;
+    uint32_t _headAddr;
+    uint32_t _headSeq;
+    uint32_t _tailAddr;
+    uint32_t _tailSeq;
+    uint32_t _readAddr;
+    uint32_t _readSeq;
+    uint32_t _dropped;
+};
+
+#endif
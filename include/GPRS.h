@@ -11,24 +11,71 @@ static const char CONNECT_OK[] PROGMEM = "CONNECT OK";
 static const char CONNECT_FAIL[] PROGMEM = "CONNECT FAIL";
 static const char CONNECT_ALREADY[] PROGMEM = "CONNECT ALREADY";
 
+/*Sockets are named by handles, given by connect() and connectAsync(): the mux assigned by the
+    modem plus a generation count (see GSM_SOCKET_MUX_BITS). Once a connection is closed, or has
+    ended and been read to the end, its handle is rejected like a free mux, even after the modem
+    gives the same mux to a new connection.
+*/
 class GPRS{
 
 public:
 
-    enum class ConnectionStatus {ERROR, CONNECT_OK, CONNECT_FAIL, CONNECT_ALREADY, TIMEOUT};
+    enum class ConnectionStatus {ERROR, CONNECT_OK, CONNECT_FAIL, CONNECT_ALREADY, TIMEOUT, PENDING};
+    //UDP has no handshake: the connect settles at once and only sets the peer of the mux
+    enum class Protocol {TCP, UDP};
+    static const uint16_t NO_CONTEXT = 0xFFFF;
     GPRS();
+    /** Bring the bearer up. The state reported by AT+CIPSTATUS and AT+CGATT? is checked first and
+        only the missing steps of CGATT=1, CIPMUX=1, CSTT, CIICR are run: a bearer still up from
+        before a sleep, with the same APN settings, is reused as it is
+    */
     NetworkStatus attachGPRS(const char* apn, const char* user_name, const char* password, bool synchronous = true);
     NetworkStatus detachGPRS(bool synchronous = true);
 
-    bool connect(const char* host, uint16_t port, uint8_t* mux, unsigned long timeout_s, ConnectionStatus* status);
-    bool close(uint8_t mux, unsigned long timeout); 
-    uint16_t send(uint8_t mux, const void* buff, uint16_t len);
-    uint16_t read(uint8_t mux, void * buf, uint16_t len = 1, unsigned long timeout = 1000L);
+    bool connect(const char* host, uint16_t port, uint8_t* mux, unsigned long timeout_s, ConnectionStatus* status,
+        Protocol protocol = Protocol::TCP);
+    /** Start a connection and return as soon as the modem has given it a mux, without waiting for
+        the connect result: several connects can be in flight, each settled by its own
+        CONNECT OK / CONNECT FAIL (in the CIPSTART response or later as a URC)
+      @param status      PENDING on success, why it failed otherwise; CONNECT_ALREADY (also a success)
+                         if the modem reports the connection as open already, without telling its
+                         mux: *mux is then left unset
+      @return false if no socket is free or the modem rejected the command
+    */
+    bool connectAsync(const char* host, uint16_t port, uint8_t* mux, unsigned long timeout_s, ConnectionStatus* status = NULL,
+        Protocol protocol = Protocol::TCP);
+    //PENDING until the connect started on mux is settled; a failed or timed out connect frees the mux
+    ConnectionStatus connectStatus(uint8_t mux);
+    //a connection already ended (see read()) is only freed, without a command
+    bool close(uint8_t mux, unsigned long timeout);
+    //on a UDP mux each call is one datagram
+    //with wait false the packet is pipelined: the call returns once it is written to the modem
+    //and its result is collected before the next command; a packet the modem then rejects is
+    //only counted by failedSends()
+    uint16_t send(uint8_t mux, const void* buff, uint16_t len, bool wait = true);
+    //packets not confirmed by the modem since the connect, pipelined or not; the result of a
+    //pipelined packet still pending is collected first
+    uint16_t failedSends(uint8_t mux);
+    /** Read received data
+      @return once minLen bytes (default: all len bytes) are read, timeout expires or the connection
+              ends (closed by the peer, bearer lost), the bytes read; -1 at the end of the
+              connection, once all the data received before has been read: the mux is then free
+    */
+    int read(uint8_t mux, void * buf, uint16_t len = 1, unsigned long timeout = 1000L, uint16_t minLen = GSM_READ_ALL);
+    //non-blocking: bytes that can be read right away
+    uint16_t available(uint8_t mux);
+    //GSM_SOCKET_CLOSED also for a free mux
+    GSM_SocketState socketState(uint8_t mux);
+    //zero-copy access to received data: up to two spans, valid until consume()
+    uint8_t peek(uint8_t mux, GSM_Span spans[2]);
+    void consume(uint8_t mux, uint16_t len);
 
     uint8_t ready();
     IPAddress getIPAddress();
     void setTimeout(unsigned long timeout);
     NetworkStatus status();
+    //time the last successful attachGPRS() took to get an IP bearer, in ms
+    unsigned long timeToIP() const { return _timeToIP; }
     
 private:
     const char* _apn;
@@ -36,8 +83,14 @@ private:
     const char* _password;
     NetworkStatus _state;
     uint8_t _readyState;
-    String _response;
+    ModemResponse _response;
     unsigned long _timeout;
+    uint16_t _context; //fingerprint of the settings of the active bearer, NO_CONTEXT if none
+    unsigned long _attachStart;
+    unsigned long _timeToIP;
+    void attached(uint16_t context);
+    static GSM_Socket* find(uint8_t handle);
+    void release(uint8_t mux);
 };
 
 #endif
@@ -8,12 +8,19 @@
 
 enum NetworkStatus {ERROR, CONNECTING, GSM_READY, GSM_OFF, GPRS_READY, GPRS_OFF};
 
-class GSM {
+//registration is followed through +CREG reports, AT+CREG? is only sent this often as a fallback
+#ifndef GSM_REGISTRATION_POLL_MS
+#define GSM_REGISTRATION_POLL_MS (30 * 1000UL)
+#endif
+#define GSM_REGISTRATION_UNKNOWN 0xFF
+
+class GSM : public ModemUrcHandler {
 
 public:
     /** Constructor
     */
     GSM();
+    virtual ~GSM();
 
     /** Start the GSM/GPRS modem, attaching to the GSM network
       @param pin         SIM PIN number (4 digits in a string, example: "1234"). If
@@ -26,7 +33,8 @@ public:
     */
     NetworkStatus init(const char* pin = 0, bool restart = false, bool synchronous = true);
 
-    /** Check network access status
+    /** Check network access status, from the last +CREG report: no command is sent once init()
+        has enabled the reports
       @return 1 if Alive, 0 if down
    */
     bool isAccessAlive();
@@ -54,14 +62,28 @@ public:
     static const char * signal2String(int8_t signalQuality);
     bool waitForNetwork(unsigned long timeout, int8_t * signal = NULL);
 
+    //follows the registration reports once init() has completed: CONNECTING while searching
     NetworkStatus status();
+    //+CREG <stat>: 1 home, 5 roaming, 2 searching, 3 denied, GSM_REGISTRATION_UNKNOWN before the first report
+    uint8_t registration() const { return _registration; }
+    //serving cell from the last report, 0 if not registered
+    uint16_t locationAreaCode() const { return _lac; }
+    uint32_t cellId() const { return _cellId; }
+
+    void handleUrc(const void* data, uint16_t len);
 
 private:
+    bool updateRegistration(const ModemResponse& line);
     NetworkStatus _state;
     uint8_t _readyState;
     const char* _pin;
-    String _response;
+    ModemResponse _response;
     unsigned long _timeout;
+    uint8_t _registration;
+    uint16_t _lac;
+    uint32_t _cellId;
+    unsigned long _registrationQuery;
+    bool _reports; //+CREG reports enabled by init()
 };
 
 #endif
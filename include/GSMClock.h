@@ -0,0 +1,68 @@
+#ifndef _GSM_CLOCK_H_INCLUDED
+#define _GSM_CLOCK_H_INCLUDED
+
+#include <Arduino.h>
+
+#include "modem.h"
+
+//period of the background resync: the modem RTC and the millis() oscillator drift apart
+#ifndef GSM_CLOCK_RESYNC_MS
+#define GSM_CLOCK_RESYNC_MS (60 * 60 * 1000UL)
+#endif
+//after a failed resync
+#ifndef GSM_CLOCK_RETRY_MS
+#define GSM_CLOCK_RETRY_MS (10 * 1000UL)
+#endif
+#define GSM_CLOCK_QUERY_TIMEOUT_MS 100
+
+/*Wall clock read from the modem once (AT+CCLK?) and then kept by millis(): now() is an addition
+    and a division, no modem round trip, so fixes can be timestamped as they come.
+
+    Once the resync interval has elapsed, or when the network sends its time (+CTZV), the next
+    now() queues a new AT+CCLK? with ModemClass::enqueue(); it completes from poll() and moves
+    the anchor, the old one keeps counting in the meantime. The clock must outlive a queued
+    resync.
+    The modem reports time with a resolution of one second, so timestamps can lag by up to 1 s.
+*/
+class GSMClock : public ModemUrcHandler {
+
+public:
+    GSMClock(unsigned long resyncMs = GSM_CLOCK_RESYNC_MS);
+    virtual ~GSMClock();
+
+    /** Read the modem clock and wait for the answer
+      @return false if the modem did not answer with a valid time
+    */
+    bool sync(unsigned long timeout = GSM_CLOCK_QUERY_TIMEOUT_MS);
+    //UTC seconds since 1970, 0 until the first sync
+    uint32_t now();
+    //now() in the time zone reported by the modem
+    uint32_t localNow();
+    //time zone offset in quarters of an hour
+    int8_t zone() const { return _zone; }
+    bool synced() const { return _synced; }
+    void setResyncInterval(unsigned long ms) { _resyncMs = ms; }
+
+    /** Parse the response to AT+CCLK?, +CCLK: "yy/MM/dd,hh:mm:ss+zz" (zone in quarters of an hour),
+        with integer arithmetic only
+      @param utc         seconds since 1970, zone offset removed
+      @param zone        time zone offset, 0 if the modem gives none
+    */
+    static bool parse(const ModemResponse& response, uint32_t* utc, int8_t* zone);
+
+    void handleUrc(const void* data, uint16_t len);
+
+private:
+    static void onTime(int result, const ModemResponse& response, void* context);
+    bool anchor(const ModemResponse& response);
+
+    unsigned long _resyncMs;
+    uint32_t _epoch;            //UTC time at _anchorMillis
+    unsigned long _anchorMillis;
+    unsigned long _syncMillis;  //time of the next resync
+    int8_t _zone;
+    bool _synced;
+    bool _queued;
+};
+
+#endif
@@ -4,6 +4,8 @@
 #include <Arduino.h>
 
 #include "modem.h"
+#include "NMEAParser.h"
+#include "PositionFix.h"
 
 class GSMLocation : public ModemUrcHandler {
 
@@ -11,24 +13,26 @@ public:
     GSMLocation();
     virtual ~GSMLocation();
 
-    bool set(bool on = true);
+    /** Turn the GPS on or off
+      @param on          GPS power
+      @param interval_s  period of the NMEA output (AT+GPSRD) in seconds, 0 to keep it off
+    */
+    bool set(bool on = true, uint8_t interval_s = 1);
+    //true once per new valid position
     bool available();
     float latitude();
     float longitude();
     long altitude();
     long accuracy();
+    //last position in the uplink format; timestamp from the GPS date and time
+    void fix(PositionFix* fix);
+    const NMEAFix& nmea() const { return _parser.fix(); }
 
-    void handleUrc(const String& urc);
+    void handleUrc(const void* data, uint16_t len);
 
 private:
-    bool _commandSent;
-    bool _locationAvailable;
-
-    float _latitude;
-    float _longitude;
-    long _altitude;
     bool _on;
-    long _uncertainty;
+    NMEAParser _parser;
 };
 
 #endif
@@ -0,0 +1,92 @@
+#ifndef _MEMORY_STATS_H_INCLUDED
+#define _MEMORY_STATS_H_INCLUDED
+
+#include <Arduino.h>
+
+//byte written over the free RAM by paintStack(): stack bytes still holding it were never used
+#define MEMORY_STACK_PAINT 0xA5
+//left unpainted below the stack pointer of paintStack(), for its own frame and the calls it makes
+#define MEMORY_STACK_GUARD 64
+//host build: the stack has no fixed bottom, this much below main() is painted
+#ifndef MEMORY_HOST_STACK_WINDOW
+#define MEMORY_HOST_STACK_WINDOW (64 * 1024UL)
+#endif
+//static objects recorded with addStatic()
+#ifndef MEMORY_STATIC_SLOTS
+#define MEMORY_STATIC_SLOTS 8
+#endif
+
+/*RAM diagnostics (see MEMORY_STATS), to size buffers and batch lengths from field data.
+
+    Stack: paintStack(), first thing in setup(), fills the RAM between the heap and the stack with
+    MEMORY_STACK_PAINT; stackPeak() then finds the deepest byte overwritten since. A frame that
+    happens to write the paint byte is missed, so the peak can be low by a few bytes.
+    Heap: sample() reads the allocator (newlib-nano on the SAMD21) and keeps the largest bytes in
+    use it has seen; the free list gives the fragmentation, the share of free heap bytes outside
+    the largest free block. This sampled peak is not a high-water mark: an allocation freed
+    between two samples is never seen. dump() and serialize() sample first, call sample() from
+    the main loop for a closer figure.
+    Static: the .data + .bss total from the linker, and the footprint of the driver objects
+    (MODEM, socket pool) plus whatever the application records with addStatic().
+*/
+class MemoryStats {
+
+public:
+    MemoryStats();
+
+    void paintStack();
+    //deepest stack use since paintStack(), in bytes; 0 if not painted
+    uint32_t stackPeak() const;
+    //smallest distance between the stack and the heap since paintStack()
+    uint32_t headroom() const;
+    //RAM between the heap and the stack pointer right now
+    uint32_t freeRam() const;
+
+    void sample();
+    uint32_t heapUsed() const { return _heapUsed; }
+    //largest heapUsed() of all the samples, not of every allocation
+    uint32_t heapSampledPeak() const { return _heapSampledPeak; }
+    //bytes the heap has taken from the free RAM (sbrk), allocated or not
+    uint32_t heapArena() const { return _heapArena; }
+    uint32_t heapFree() const { return _heapFree; }
+    uint32_t largestFree() const { return _largestFree; }
+    //percent of the free heap bytes not in the largest free block
+    uint8_t fragmentation() const;
+
+    /** Record the static footprint of a subsystem, e.g. addStatic("capture", sizeof(capture))
+      @param name        kept as a pointer: a string literal
+      @return false if all MEMORY_STATIC_SLOTS are taken
+    */
+    bool addStatic(const char* name, uint32_t bytes);
+    //.data + .bss, 0 on the host build
+    uint32_t staticTotal() const;
+
+    //one line each for stack, heap and static RAM, then the footprint of each subsystem
+    void dump(Print& out);
+    /** Compact binary snapshot for the uplink, LEB128 varints like ModemStats::serialize():
+        version, stack peak, headroom, heap used, heap sampled peak, heap arena, heap free, largest free
+        block, static total, then the number of subsystems and the footprint of each one
+        (in recording order)
+      @return bytes written, 0 if size is too small
+    */
+    uint16_t serialize(uint8_t* out, uint16_t size);
+
+private:
+    const char* lowestStackUse() const;
+
+    const char* _stackTop;
+    const char* _paintStart; //lowest painted byte, NULL if not painted
+    const char* _paintEnd;
+    uint32_t _heapUsed;
+    uint32_t _heapSampledPeak;
+    uint32_t _heapArena;
+    uint32_t _heapFree;
+    uint32_t _largestFree;
+    const char* _staticNames[MEMORY_STATIC_SLOTS];
+    uint32_t _staticBytes[MEMORY_STATIC_SLOTS];
+    uint8_t _staticCount;
+};
+
+extern MemoryStats MEMORY_STATS;
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef _MODEM_CAPTURE_H_INCLUDED
+#define _MODEM_CAPTURE_H_INCLUDED
+
+#include <Arduino.h>
+
+/*Recording of the raw UART traffic between the driver and the modem, to be dumped from the
+    field and replayed on the host (native/replay_main.cpp).
+
+    Bytes are kept in a RAM ring as records: a header byte (bit 7 set for TX, bits 0-6 length),
+    the milliseconds elapsed since the previous record as a LEB128 varint, then the bytes. Bytes
+    going the same way within the same millisecond extend the open record. When the ring is full
+    the oldest records are dropped whole, so a dump always starts on a record boundary.
+
+    dump() prints a text transcript, one record per line, with the millis() of each record:
+        # A9G capture v1
+        T 1520 41542B435351
+        R 1541 0D0A2B4353513A2032332C300D0A
+*/
+
+enum ModemCaptureDirection {
+    MODEM_CAPTURE_RX = 0,
+    MODEM_CAPTURE_TX = 1
+};
+
+class ModemCapture {
+
+public:
+    void record(ModemCaptureDirection direction, const uint8_t* data, uint16_t len);
+    void record(ModemCaptureDirection direction, uint8_t c)
+    {
+        record(direction, &c, 1);
+    }
+    void clear();
+    void dump(Print& out) const;
+    uint16_t used() const { return _used; }
+    uint16_t capacity() const { return _size; }
+    //bytes of traffic dropped with the oldest records since clear()
+    uint32_t lost() const { return _lost; }
+
+protected:
+    ModemCapture(uint8_t* buffer, uint16_t size);
+
+private:
+    uint16_t wrap(uint32_t pos) const { return pos % _size; }
+    uint16_t readVarint(uint16_t pos, unsigned long* value) const;
+    void startRecord(ModemCaptureDirection direction, unsigned long now);
+    void reserve(uint16_t len);
+    void dropOldest();
+    void put(uint8_t c);
+    uint8_t* _buffer;
+    uint16_t _size;
+    uint16_t _maxRecord; //record length cap, so that the open record never has to be dropped
+    uint16_t _tail;      //header of the oldest record
+    uint16_t _used;
+    uint16_t _open;      //header of the record being extended, CAPTURE_NO_RECORD if none
+    ModemCaptureDirection _openDirection;
+    unsigned long _firstMillis; //time of the oldest record
+    unsigned long _lastMillis;  //time of the newest record
+    uint32_t _lost;
+};
+
+template <uint16_t SIZE>
+class ModemCaptureBuffer: public ModemCapture {
+
+    static_assert(SIZE >= 32, "capture buffer too small");
+public:
+    ModemCaptureBuffer(): ModemCapture(_storage, SIZE) {}
+private:
+    uint8_t _storage[SIZE];
+};
+
+#endif
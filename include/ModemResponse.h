@@ -0,0 +1,44 @@
+#ifndef _MODEM_RESPONSE_H_INCLUDED
+#define _MODEM_RESPONSE_H_INCLUDED
+
+#include <stdint.h>
+
+/*Non-owning view of a command response, or of a part of one: the text lives in the response
+    arena of ModemClass (see waitForResponse()) and is not NUL terminated in general.
+    The extractors return narrower views, an empty one when what they look for is not there, so
+    they chain: response.after("+CREG:").field(1).toInt(&stat)
+*/
+class ModemResponse {
+
+public:
+    ModemResponse(): _data(""), _len(0) {}
+    ModemResponse(const char* data, uint16_t len): _data(data), _len(len) {}
+
+    const char* data() const { return _data; }
+    uint16_t length() const { return _len; }
+    bool empty() const { return _len == 0; }
+    //offset of the first occurrence of text, -1 if none
+    int16_t indexOf(const char* text) const;
+    bool contains(const char* text) const { return indexOf(text) >= 0; }
+    //index-th non blank line, without its terminator
+    ModemResponse line(uint8_t index = 0) const;
+    //rest of the line starting with the first occurrence of prefix, leading spaces skipped
+    ModemResponse after(const char* prefix) const;
+    //index-th comma separated field of the first line, spaces trimmed; commas between quotes do not split
+    ModemResponse field(uint8_t index) const;
+    //text between the index-th pair of double quotes
+    ModemResponse quoted(uint8_t index = 0) const;
+    //decimal integer at the start of the view, optional sign; false if there are no digits
+    bool toInt(long* value) const;
+    //hexadecimal digits at the start of the view; false if there are none
+    bool toHex(uint32_t* value) const;
+    bool intAfter(const char* prefix, long* value) const { return after(prefix).toInt(value); }
+    //NUL terminated copy, truncated to size - 1 chars; returns the chars copied
+    uint16_t copyTo(char* dst, uint16_t size) const;
+
+private:
+    const char* _data;
+    uint16_t _len;
+};
+
+#endif
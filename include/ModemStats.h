@@ -0,0 +1,102 @@
+#ifndef _MODEM_STATS_H_INCLUDED
+#define _MODEM_STATS_H_INCLUDED
+
+#include <Arduino.h>
+
+//latency histogram buckets, upper bounds in ms: 10 20 50 100 200 500 1k 2k 5k 10k 30k, then above
+#define MODEM_STATS_BUCKETS 12
+//sockets tracked, one per mux (MAX_SOCKETS of ModemClass)
+#define MODEM_STATS_SOCKETS 3
+
+/*Command classes, from the extended command name (sorted, checked at compile time).
+    Basic commands (AT, ATE1, AT&F...) are MODEM_CMD_BASIC, unlisted extended ones MODEM_CMD_OTHER.
+*/
+#define MODEM_CMD_LIST(X) \
+    X(AGPS)     \
+    X(CCLK)     \
+    X(CGATT)    \
+    X(CIFSR)    \
+    X(CIICR)    \
+    X(CIPCLOSE) \
+    X(CIPMUX)   \
+    X(CIPSEND)  \
+    X(CIPSHUT)  \
+    X(CIPSTART) \
+    X(CMGF)     \
+    X(CPIN)     \
+    X(CREG)     \
+    X(CSQ)      \
+    X(CSTT)     \
+    X(GPSRD)    \
+    X(IPR)
+
+#define MODEM_CMD_ENUM(name) MODEM_CMD_##name,
+enum ModemCommandClass {
+    MODEM_CMD_LIST(MODEM_CMD_ENUM)
+    MODEM_CMD_BASIC,
+    MODEM_CMD_OTHER,
+    MODEM_CMD_COUNT
+};
+#undef MODEM_CMD_ENUM
+
+struct ModemCommandStats {
+    uint16_t buckets[MODEM_STATS_BUCKETS]; //send to result latency, saturating counts
+    uint16_t ok;
+    uint16_t error;    //ERROR
+    uint16_t cmeError; //+CME ERROR
+    uint16_t cmsError; //+CMS ERROR
+    uint16_t timeouts;
+    uint32_t maxMs;
+};
+
+struct ModemSocketStats {
+    uint32_t bytesIn;
+    uint32_t bytesOut;
+    uint32_t droppedBytes; //received while the buffer was full
+    uint16_t overflows;
+};
+
+/*Health counters kept by ModemClass (see ModemClass::stats()): latency histogram and result
+    counts per command class, receive overflows and traffic per socket.
+    Costs about 700 bytes of RAM, build with -DMODEM_NO_STATS to leave it out.
+*/
+class ModemStats {
+
+public:
+    ModemStats();
+
+    static ModemCommandClass classify(const char* command);
+    static const char* name(ModemCommandClass command);
+
+    //a command was issued
+    void start(const char* command);
+    /** The command issued last completed
+      @param code        ready() code: 1 OK, 2 ERROR, 3 +CME ERROR, 4 +CMS ERROR
+    */
+    void result(uint8_t code);
+    void timeout();
+    void received(uint8_t mux, uint16_t stored, uint16_t dropped);
+    void sent(uint8_t mux, uint16_t len);
+
+    const ModemCommandStats& command(ModemCommandClass command) const { return _commands[command]; }
+    const ModemSocketStats& socket(uint8_t mux) const { return _sockets[mux]; }
+    void reset();
+
+    //one line per command class used and per socket, e.g. for SerialUSB
+    void dump(Print& out) const;
+    /** Compact binary snapshot for the uplink, all LEB128 varints: version, number of command
+        classes used, then for each one its id, a mask of the non empty buckets, those buckets,
+        ok, error, cme, cms, timeouts and max latency; then the number of sockets and for each one
+        bytes in, bytes out, dropped bytes and overflows
+      @return bytes written, 0 if size is too small
+    */
+    uint16_t serialize(uint8_t* out, uint16_t size) const;
+
+private:
+    ModemCommandStats _commands[MODEM_CMD_COUNT];
+    ModemSocketStats _sockets[MODEM_STATS_SOCKETS];
+    int8_t _pending; //class of the command in flight, -1 if none
+    unsigned long _start;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef _MODEM_URC_H_INCLUDED
+#define _MODEM_URC_H_INCLUDED
+
+#include <stdint.h>
+
+/*Known unsolicited result codes, sorted by prefix (checked at compile time).
+    name, line prefix, unsolicited only: true if the line is never part of a command response,
+    so it can be routed to its handlers even while a command is pending.
+    A prefix ending with a letter only matches when the line continues with a delimiter
+    (':' ',' ' ' or end of line): "+CMT" does not match "+CMTI: ...".
+    Per connection reports "<mux>, <status>" (e.g. "1, CONNECT OK", "1, CLOSED") all match the
+    "0, " entry.
+    Registration reports share their prefix with the AT+CREG? / AT+CGREG? response and are told
+    apart by their parameters, see modemUrcUnsolicited().
+*/
+#define MODEM_URC_LIST(X) \
+    X(NMEA,         "$",            true)   \
+    X(CGREG,        "+CGREG",       false)  \
+    X(CIEV,         "+CIEV",        true)   \
+    X(CIPCLOSE,     "+CIPCLOSE",    true)   \
+    X(CMT,          "+CMT",         true)   \
+    X(CMTI,         "+CMTI",        true)   \
+    X(CPIN,         "+CPIN",        false)  \
+    X(CREG,         "+CREG",        false)  \
+    X(CTZV,         "+CTZV",        true)   \
+    X(GPSRD,        "+GPSRD",       true)   \
+    X(PDP,          "+PDP",         true)   \
+    X(SOCKET,       "0, ",          true)   \
+    X(CLOSED,       "CLOSED",       true)   \
+    X(CONNECT_FAIL, "CONNECT FAIL", true)   \
+    X(CONNECT_OK,   "CONNECT OK",   true)   \
+    X(NO_CARRIER,   "NO CARRIER",   true)   \
+    X(RING,         "RING",         true)
+
+#define MODEM_URC_ENUM(name, prefix, unsolicited) MODEM_URC_##name,
+enum ModemUrc {
+    MODEM_URC_LIST(MODEM_URC_ENUM)
+    MODEM_URC_COUNT,
+    MODEM_URC_UNKNOWN = MODEM_URC_COUNT //any other line
+};
+#undef MODEM_URC_ENUM
+
+//compile time checks of the prefix tables (URCs here, command classes in ModemStats.h)
+constexpr bool modemPrefixLess(const char* a, const char* b)
+{
+    return *a == *b ? (*a != '\0' && modemPrefixLess(a + 1, b + 1)) : (uint8_t) *a < (uint8_t) *b;
+}
+
+/** Identify a URC line by binary search of the prefix table
+  @return MODEM_URC_UNKNOWN if no prefix matches
+*/
+ModemUrc modemUrcLookup(const char* line, uint16_t len);
+//true if the URC is never part of a command response
+bool modemUrcUnsolicited(ModemUrc urc);
+//true if this line of the URC can only be unsolicited: also the "+CREG: <stat>[,<lac>,<ci>]" form,
+//where the response to AT+CREG? is "+CREG: <n>,<stat>[,<lac>,<ci>]"
+bool modemUrcUnsolicited(ModemUrc urc, const char* line, uint16_t len);
+const char* modemUrcPrefix(ModemUrc urc);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef _NMEA_PARSER_H_INCLUDED
+#define _NMEA_PARSER_H_INCLUDED
+
+#include <stdint.h>
+
+//longest field kept while parsing (coordinates are ~11 chars)
+#define NMEA_FIELD_MAX 15
+//user equivalent range error used to turn HDOP into an accuracy estimate, in centimeters
+#ifndef NMEA_UERE_CM
+#define NMEA_UERE_CM 500
+#endif
+
+//navigation data decoded from NMEA 0183 sentences, in fixed point
+struct NMEAFix {
+    int32_t latitude;   //degrees * 1e6
+    int32_t longitude;  //degrees * 1e6
+    int32_t altitude;   //decimeters above mean sea level
+    uint16_t hdop;      //* 100
+    uint16_t pdop;      //* 100
+    uint16_t vdop;      //* 100
+    uint16_t speed;     //km/h * 100
+    uint16_t course;    //degrees * 100
+    uint8_t satellites;
+    uint8_t quality;    //GGA fix quality, 0 when invalid
+    uint8_t fixType;    //GSA fix type: 1 none, 2 2D, 3 3D
+    uint32_t time;      //hhmmss UTC
+    uint32_t date;      //ddmmyy
+    bool valid;         //last GGA/RMC reported a valid position
+};
+
+/*Streaming, allocation free NMEA 0183 parser: bytes are fed one at a time and only the field being
+    received is buffered. GGA, RMC, GSA and VTG sentences (any talker) are decoded; a sentence
+    updates the fix only if its checksum is correct.
+*/
+class NMEAParser {
+
+public:
+    NMEAParser();
+
+    /** Feed one byte of the NMEA stream
+      @return true when a complete, valid sentence updated the fix
+    */
+    bool feed(char c);
+    bool feed(const char* data, uint16_t len);
+
+    const NMEAFix& fix() const { return _fix; }
+    //true once per new valid position: GGA and RMC of the same epoch count as one
+    bool updated();
+    //estimated horizontal accuracy in meters, from HDOP
+    uint16_t accuracy() const;
+    //UTC seconds since epoch from the last RMC date and time, 0 if unknown
+    uint32_t epoch() const;
+
+    uint32_t sentences() const { return _sentences; }
+    uint32_t checksumErrors() const { return _checksumErrors; }
+
+private:
+    enum {
+        NMEA_IDLE,
+        NMEA_BODY,
+        NMEA_CHECKSUM
+    } _state;
+
+    enum {
+        SENTENCE_OTHER,
+        SENTENCE_GGA,
+        SENTENCE_RMC,
+        SENTENCE_GSA,
+        SENTENCE_VTG
+    } _sentence;
+
+    void endField();
+    bool endSentence();
+
+    char _field[NMEA_FIELD_MAX + 1];
+    uint8_t _fieldLen;
+    uint8_t _fieldIndex;
+    uint8_t _checksum;
+    uint8_t _received;
+    uint8_t _checksumDigits;
+    bool _overflow;
+    bool _positionInSentence;
+    NMEAFix _fix;
+    NMEAFix _pending; //fix being updated by the current sentence
+    bool _updated;
+    uint32_t _updatedTime; //time of the last position reported by updated()
+    uint32_t _sentences;
+    uint32_t _checksumErrors;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _POSITION_CODEC_H_INCLUDED
+#define _POSITION_CODEC_H_INCLUDED
+
+#include <stdint.h>
+
+#include "PositionFix.h"
+
+/*Compact binary format for batches of position fixes, free of Arduino dependencies so that
+    servers and host tools can build the decoder as is.
+
+    [format tag][count][base record][delta record]...
+
+    The base record holds the first fix; every following record holds the difference from the
+    previous fix. Each field (latitude, longitude, altitude, accuracy, timestamp) is stored as a
+    zig-zag encoded LEB128 varint, so a fix taken seconds after the previous one costs ~6-8 bytes
+    instead of 18.
+*/
+
+#define POSITION_CODEC_FORMAT 0x01
+#define POSITION_CODEC_HEADER_SIZE 2
+//worst case size of one record: five 32 bit varints
+#define POSITION_CODEC_RECORD_MAX 25
+#define POSITION_CODEC_MAX_FIXES 255
+
+class PositionEncoder {
+
+public:
+    PositionEncoder(uint8_t* out, uint16_t size);
+
+    /** Append a fix to the payload
+      @return false if it does not fit in the buffer (nothing is written)
+    */
+    bool add(const PositionFix& fix);
+    uint16_t length() const { return _count ? _length : 0; }
+    uint8_t count() const { return _count; }
+
+private:
+    uint8_t* _out;
+    uint16_t _size;
+    uint16_t _length;
+    uint8_t _count;
+    PositionFix _last;
+};
+
+class PositionDecoder {
+
+public:
+    PositionDecoder(const uint8_t* data, uint16_t len);
+
+    /** Decode the next fix
+      @return false at the end of the payload or if it is malformed (see error())
+    */
+    bool next(PositionFix* fix);
+    uint8_t count() const { return _count; }
+    bool error() const { return _error; }
+    //bytes read so far: the payload length once next() returned false, to split a stream of payloads
+    uint16_t consumed() const { return _pos; }
+
+private:
+    const uint8_t* _data;
+    uint16_t _len;
+    uint16_t _pos;
+    uint8_t _count;
+    uint8_t _decoded;
+    bool _error;
+    PositionFix _last;
+};
+
+#endif
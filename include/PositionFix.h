@@ -0,0 +1,15 @@
+#ifndef _POSITION_FIX_H_INCLUDED
+#define _POSITION_FIX_H_INCLUDED
+
+#include <stdint.h>
+
+//position fix in integer units, as queued and sent by the uplink
+struct PositionFix {
+    int32_t latitude;   //degrees * 1e6
+    int32_t longitude;  //degrees * 1e6
+    int32_t altitude;   //meters
+    uint16_t accuracy;  //meters
+    uint32_t timestamp; //seconds since epoch (UTC)
+};
+
+#endif
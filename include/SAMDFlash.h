@@ -0,0 +1,41 @@
+#ifndef _SAMD_FLASH_H_INCLUDED
+#define _SAMD_FLASH_H_INCLUDED
+
+#include "FlashDevice.h"
+
+#if defined(ARDUINO_ARCH_SAMD)
+
+#include <Arduino.h>
+
+/*Reserves size bytes of program flash, row aligned and erased by the first FlashLog::begin().
+    The region is part of the sketch image: uploading a new sketch wipes it.
+    usage: SAMD_FLASH_REGION(logArea, 16 * 1024); SAMDFlash flash(logArea, sizeof(logArea));
+*/
+#define SAMD_FLASH_REGION(name, size) \
+    __attribute__((__aligned__(256))) static const uint8_t name[((size) + 255) / 256 * 256] = { }
+
+//SAMD21 internal flash (NVMCTRL): 64 byte pages, 256 byte rows
+class SAMDFlash : public FlashDevice {
+
+public:
+    SAMDFlash(const void* region, uint32_t size);
+
+    uint32_t size() const { return _size; }
+    uint16_t pageSize() const { return _pageSize; }
+    uint16_t rowSize() const { return _pageSize * NVMCTRL_ROW_PAGES; }
+
+    void read(uint32_t address, void* data, uint16_t len);
+    bool write(uint32_t address, const void* data, uint16_t len);
+    bool erase(uint32_t address);
+
+private:
+    void command(uint32_t cmd);
+
+    volatile uint8_t* _region;
+    uint32_t _size;
+    uint16_t _pageSize;
+};
+
+#endif
+
+#endif
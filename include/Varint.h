@@ -0,0 +1,45 @@
+#ifndef _VARINT_H_INCLUDED
+#define _VARINT_H_INCLUDED
+
+#include <stdint.h>
+
+//LEB128: 7 bits per byte, low bits first, bit 7 set on all bytes but the last
+//writes value at out[*pos] and moves *pos past it; false if it does not fit in size bytes
+inline bool putVarint(uint8_t* out, uint16_t size, uint16_t* pos, uint32_t value)
+{
+    do {
+        if (*pos >= size) return false;
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        out[(*pos)++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return true;
+}
+
+//reads the value at in[*pos] and moves *pos past it; false if it is cut short or longer than 5 bytes
+inline bool getVarint(const uint8_t* in, uint16_t len, uint16_t* pos, uint32_t* value)
+{
+    uint32_t result = 0;
+    for (uint8_t shift = 0; shift < 35 && *pos < len; shift += 7){
+        uint8_t byte = in[(*pos)++];
+        result |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)){
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+//zig-zag mapping of signed values to unsigned ones, so that small magnitudes get short varints
+inline uint32_t zigzag(int32_t value)
+{
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+inline int32_t unzigzag(uint32_t value)
+{
+    return static_cast<int32_t>((value >> 1) ^ (~(value & 1) + 1));
+}
+
+#endif
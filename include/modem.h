@@ -1,15 +1,65 @@
 #ifndef _MODEM_INCLUDED_H
 #define _MODEM_INCLUDED_H
 
-#include <stdarg.h>
+#include <type_traits>
 
 #include <Arduino.h>
 
+#include "ModemResponse.h"
+#include "ModemUrc.h"
+#include "ModemStats.h"
+#include "ModemCapture.h"
 
 #define MODEM_MIN_RESPONSE_OR_URC_WAIT_TIME_MS 20
 
-//uncomment next line to debug on SerialUSB
+//maximum time the modem takes to confirm an AT+CIPSEND
+#define MODEM_SEND_TIMEOUT_MS (60 * 1000L)
+
+//rates tried by init() and negotiateBaudRate(), lowest first: 115200 is the A9G factory default
+#ifndef MODEM_BAUD_RATES
+#define MODEM_BAUD_RATES 115200, 230400, 460800, 921600
+#endif
+//time a candidate rate is given to answer an AT
+#define MODEM_BAUD_SENSE_MS 1000
+//echo burst run at each rate by negotiateBaudRate(): lines and payload bytes per line
+#ifndef MODEM_BAUD_PROBE_LINES
+#define MODEM_BAUD_PROBE_LINES 8
+#endif
+#ifndef MODEM_BAUD_PROBE_SIZE
+#define MODEM_BAUD_PROBE_SIZE 64
+#endif
+#define MODEM_BAUD_PROBE_TIMEOUT_MS 500
+//attempts at getting back to the last clean rate from a failing one
+#define MODEM_BAUD_RETRIES 3
+
+//size of the fixed receive buffer holding the line (or response) being parsed
+#ifndef MODEM_BUFFER_SIZE
+#define MODEM_BUFFER_SIZE 256
+#endif
+
+/*Response arena: the responses kept for callers (see waitForResponse()) are copied there and
+    handed out as ModemResponse views, nothing is allocated per command. One slot holds the
+    response of the last command waited for, one slot per queue entry the response of a queued
+    command; longer responses are truncated.
+*/
+#ifndef MODEM_RESPONSE_SIZE
+#define MODEM_RESPONSE_SIZE 128
+#endif
+#ifndef MODEM_QUEUE_RESPONSE_SIZE
+#define MODEM_QUEUE_RESPONSE_SIZE 64
+#endif
+
+//health counters (see ModemStats.h), build with -DMODEM_NO_STATS to leave them out
+#ifndef MODEM_NO_STATS
+#define MODEM_STATS(call) _stats.call
+#else
+#define MODEM_STATS(call)
+#endif
+
+//comment out next line (or build with -DGSM_NO_DEBUG) to stop debugging on SerialUSB
+#ifndef GSM_NO_DEBUG
 #define GSM_DEBUG SerialUSB
+#endif
 
 /*If defined, all commands X sent to the modem are printed on the uart with the following syntax:
     "#DEBUG# command sent: X"
@@ -53,13 +103,53 @@ static const char GSM_OK[] PROGMEM = "\r\nOK\r\n";
 static const char GSM_ERROR[] PROGMEM = "\r\nERROR\r\n";
 static const char GSM_CME_ERROR[] PROGMEM = "+CME ERROR";
 static const char GSM_CMS_ERROR[] PROGMEM = "+CMS ERROR";
-static const char CLOCK_FORMAT[] PROGMEM = "+CCLK: \"%y/%m/%d,%H:%M:%S\"";
 static const char PROMPT[] PROGMEM = "\r\n>";
+static const char URC_CIPRCV[] PROGMEM = "+CIPRCV,";
+
+
+//asynchronous command queue: number of commands and maximum command length
+#ifndef MODEM_QUEUE_SIZE
+#define MODEM_QUEUE_SIZE 4
+#endif
+#ifndef MODEM_QUEUE_COMMAND_SIZE
+#define MODEM_QUEUE_COMMAND_SIZE 64
+#endif
 
+//URC handler slots, each one subscribed to any number of the prefixes of ModemUrc.h
+#ifndef MAX_URC_HANDLERS
+#define MAX_URC_HANDLERS 4
+#endif
+static_assert(MAX_URC_HANDLERS <= 8, "URC routes are 8 bit masks");
 
 class GSM_Socket;
 class GPRS;
 
+//string parameter of an AT command, written between double quotes
+struct ModemQuoted {
+    explicit ModemQuoted(const char* value): str(value) {}
+    const char* str;
+};
+
+//integer parameter zero padded to width digits, with an explicit sign if sign is set (printf "%+.2d")
+struct ModemPadded {
+    ModemPadded(long number, uint8_t digits, bool withSign = false): value(number), width(digits), sign(withSign) {}
+    long value;
+    uint8_t width;
+    bool sign;
+};
+
+//completion of a queued command: result is the ready() code (1 OK, >1 error) or -1 on timeout
+typedef void (*ModemCallback)(int result, const ModemResponse& response, void* context);
+
+//future-like handle of a queued command, filled in by ModemClass::poll(); must outlive the command
+struct ModemFuture {
+    ModemFuture(): result(0) {}
+    bool done() const { return result != 0; }
+    int result; //0 while pending, then as in ModemCallback
+    //valid until the queue entry is reused, MODEM_QUEUE_SIZE commands later
+    ModemResponse response;
+};
+
 class ModemUrcHandler {
     public:
     virtual void handleUrc(const void* data, uint16_t len) = 0;
@@ -84,30 +174,81 @@ public:
     uint16_t write(const uint8_t* buf, uint16_t len);
     void flush();
     void send(const char* command);
-    void send(__FlashStringHelper* command);
+    void send(const __FlashStringHelper* command);
     void send(const String& command)
     {
         send(command.c_str());
     }
-    void sendf(const char* fmt, ...);
+    /** Issue a command built from its parts, written straight to the UART: no format string,
+        no intermediate buffer, e.g. send("AT+CIPSEND=", mux, ',', len)
+      @param parts       string literals, F() strings, Strings, chars, integers, ModemQuoted,
+                         ModemPadded; any other type is a compile error
+    */
+    template<typename First, typename Second, typename... Rest>
+    void send(const First& first, const Second& second, const Rest&... rest)
+    {
+        beginSend(commandText(first));
+        put(first);
+        put(second);
+        int parts[] = {0, (put(rest), 0)...};
+        (void) parts;
+        endSend();
+    }
 
 
-    int waitForResponse(unsigned long timeout = 100L, String* responseDataStorage = NULL);
+    /** Wait for the result code of the command just sent
+      @param response    if not NULL, set to the response (result code included, surrounding blanks
+                         trimmed): a view valid until the next response kept this way
+      @return 1 OK, 2 ERROR, 3 +CME ERROR, 4 +CMS ERROR, -1 on timeout
+    */
+    int waitForResponse(unsigned long timeout = 100L, ModemResponse* response = NULL);
+    /** Queue a command, issued from poll() once the modem is idle and the 20 ms gap has elapsed
+      @param command     command line, copied (at most MODEM_QUEUE_COMMAND_SIZE - 1 chars)
+      @param timeout     time allowed for the response, from when the command is issued
+      @return false if the queue is full or the command too long
+    */
+    bool enqueue(const char* command, unsigned long timeout, ModemCallback callback, void* context = NULL);
+    bool enqueue(const char* command, unsigned long timeout, ModemFuture* future);
+    uint8_t queued() const { return _queueCount; }
     void poll();
     void checkUrc();
     uint8_t ready();
+    //rate init() tries first, e.g. the one stored after a negotiateBaudRate() of a previous boot
     void setBaudRate(unsigned long baud);
+    unsigned long baudRate() const { return _baud; }
+    /** Step up through MODEM_BAUD_RATES from the current rate, running an echo burst of
+        MODEM_BAUD_PROBE_LINES CRC-checked lines at each one, and keep the fastest rate with
+        no errors. The rate is saved in the modem profile (AT&W), so the modem boots at it and
+        init() keeps it; init() finds it first when given the same rate with setBaudRate()
+      @param maxBaud     fastest rate tried
+      @return the rate in use, 0 if the modem no longer answers (power cycle and init() again)
+    */
+    unsigned long negotiateBaudRate(unsigned long maxBaud = 921600);
+    /** Route the URCs with a known prefix to handler, a lookup in a sorted table per line
+      @param urc         prefix id from ModemUrc.h, MODEM_URC_UNKNOWN for lines matching no prefix
+      @return false if all MAX_URC_HANDLERS slots are taken
+    */
+    bool addUrcHandler(ModemUrcHandler* handler, ModemUrc urc);
+    //every URC line, known prefix or not
+    bool addUrcHandler(ModemUrcHandler* handler);
     void removeUrcHandler(ModemUrcHandler* handler);
-    void addUrcHandler(ModemUrcHandler* handler);
     bool turnEcho(bool on);    
     bool streamSkipUntil(const char& c, String* save = NULL, const uint32_t timeout_ms = 10000L);
     int16_t streamGetIntBefore(const char& lastChar);
-    inline void setResponseDataStorage(String* dest)
+    //keep the response of the next command in dest, as waitForResponse() does, for callers polling ready()
+    inline void setResponseDataStorage(ModemResponse* dest)
     {
-        _responseDataStorage = dest;
+        keepResponse(dest, 0);
     }
+#ifndef MODEM_NO_STATS
+    ModemStats& stats() { return _stats; }
+#endif
+    /** Record all the UART traffic into capture (see ModemCapture.h), NULL to stop recording
+    */
+    void setCapture(ModemCapture* capture) { _capture = capture; }
 
 private:
+    friend class ModemReplay;
     Uart* _uart;
     unsigned long _baud;
     bool _lowPowerMode;
@@ -115,15 +256,75 @@ private:
     bool _init;
     uint16_t _chunkLen;
     uint8_t _sock; //socket that will receive the chunk
-    void beginSend();
+    uint8_t _chunkSavedReady; //ready() level hidden while a chunk arrives with no command pending
+    bool wakeAt(unsigned long baud, unsigned int timeout);
+    bool switchBaudRate(unsigned long baud);
+    bool probeEcho();
+    void beginSend(const char* command);
+    void endSend();
+    void collectSend();
+    static const char* commandText(const char* command) { return command; }
+    static const char* commandText(const __FlashStringHelper* command) { return reinterpret_cast<const char*>(command); }
+    static const char* commandText(const String& command) { return command.c_str(); }
+    template<typename T>
+    static const char* commandText(const T&) { return NULL; }
+    //NULL is written as an empty string, e.g. ModemQuoted(NULL) as ""
+    void put(const char* str) { if (str != NULL) write((const uint8_t*) str, strlen(str)); }
+    void put(const __FlashStringHelper* str) { put(reinterpret_cast<const char*>(str)); }
+    void put(const String& str) { write((const uint8_t*) str.c_str(), str.length()); }
+    void put(char c) { write(c); }
+    void put(const ModemQuoted& quoted);
+    void put(const ModemPadded& padded);
+    template<typename T>
+    void put(const T& value)
+    {
+        static_assert(std::is_integral<T>::value, "AT command parts: strings, chars, integers, ModemQuoted or ModemPadded");
+        putInteger(value, std::is_signed<T>());
+    }
+    template<typename T>
+    void putInteger(T value, std::true_type) { putNumber(value < 0 ? 0UL - (unsigned long) value : value, 0, value < 0 ? '-' : 0); }
+    template<typename T>
+    void putInteger(T value, std::false_type) { putNumber(value, 0, 0); }
+    void putNumber(unsigned long value, uint8_t width, char sign);
+    //every byte read from the modem goes through here, to be captured
+    inline int readUart()
+    {
+        int c = _uart->read();
+        if (_capture != NULL && c >= 0){
+            _capture->record(MODEM_CAPTURE_RX, (uint8_t) c);
+        }
+        return c;
+    }
+    bool checkChunkHeader();
+    bool dispatchUrc(ModemUrc urc);
+    bool socketReport(ModemUrc urc);
+    bool connectResult(int8_t mux, int8_t result);
+    bool socketEnded(int8_t mux, bool byPeer);
+    uint16_t lineLength() const;
+    int8_t urcSlot(ModemUrcHandler* handler);
+    bool enqueue(const char* command, unsigned long timeout, ModemCallback callback, void* context, ModemFuture* future);
+    void processQueue();
+    void resetResponse();
+    void keepResponse(ModemResponse* dest, uint8_t slot);
+    inline bool commandPending() const
+    {
+        return _sent || _atCommandState == AT_RECV_RESP;
+    }
+    void bufferPut(char c);
+    void clearBuffer();
+    bool lineStartsWith(const char* prefix, uint16_t len) const;
+    uint8_t resultCode() const;
+    void completeResponse(uint8_t code);
     #define MAX_SOCKETS 3
+    static_assert(MAX_SOCKETS == MODEM_STATS_SOCKETS, "ModemStats keeps one counter set per socket");
     GSM_Socket* _sockets[MAX_SOCKETS] = {NULL};
     uint8_t _initSocks;
     
     enum 
     {
         URC_IDLE,
-        URC_RECV_SOCK_CHUNK
+        URC_RECV_SOCK_CHUNK,
+        URC_SKIP_CHUNK_END
     } _urcState;
 
     enum
@@ -134,10 +335,40 @@ private:
 
     uint8_t _ready;
     bool _sent;
-    String _buffer;
-    String* _responseDataStorage;
-    #define MAX_URC_HANDLERS 1
+    char _buffer[MODEM_BUFFER_SIZE + 1]; //always NUL terminated
+    uint16_t _bufferLen;
+    uint16_t _lineStart; //offset of the line currently being received
+    bool _echo;
+    GSM_Socket* _sendPending; //socket of a CIPSEND issued without waiting for its result, NULL if none
+    uint16_t _sendPendingLen;
+
+    struct QueuedCommand {
+        char command[MODEM_QUEUE_COMMAND_SIZE];
+        unsigned long timeout;
+        ModemCallback callback;
+        void* context;
+        ModemFuture* future;
+    };
+    QueuedCommand _queue[MODEM_QUEUE_SIZE];
+    uint8_t _queueHead;
+    uint8_t _queueCount;
+    bool _queueActive; //the command at _queueHead has been issued
+    unsigned long _queueStart;
+    uint8_t _queueSavedReady; //ready() level hidden while a queued command runs
+    ModemResponse _queueResponse;
+    ModemResponse* _responseDataStorage;
+    uint8_t _responseSlot; //arena slot of _responseDataStorage: 0, or 1 + the queue entry
+    char _responseArena[MODEM_RESPONSE_SIZE + 1 + MODEM_QUEUE_SIZE * (MODEM_QUEUE_RESPONSE_SIZE + 1)];
     ModemUrcHandler* _urcHandlers[MAX_URC_HANDLERS] = {NULL};
+    uint8_t _urcRoutes[MODEM_URC_COUNT + 1] = {0}; //bit i: _urcHandlers[i] subscribed
+#ifndef MODEM_NO_STATS
+    ModemStats _stats;
+#endif
+    ModemCapture* _capture;
+    //a CIPSTART is pending: its connect result may come before the +CIPNUM telling its mux
+    bool _connectInFlight;
+    int8_t _earlyConnect;    //0 none, 1 CONNECT OK, -1 CONNECT FAIL
+    int8_t _earlyConnectMux; //-1 if the result did not tell the mux
 };
 
 extern ModemClass MODEM;
@@ -3,24 +3,90 @@
 
 #include "modem.h"
 
-#define BUFFER_MAX 128 
+//receive buffer of each socket, in bytes: must be a power of two (at most 32768)
+//the size can be chosen per mux by defining GSM_SOCKET<mux>_BUFFER_SIZE
+#ifndef GSM_SOCKET_BUFFER_SIZE
+#define GSM_SOCKET_BUFFER_SIZE 512
+#endif
+#ifndef GSM_SOCKET0_BUFFER_SIZE
+#define GSM_SOCKET0_BUFFER_SIZE GSM_SOCKET_BUFFER_SIZE
+#endif
+#ifndef GSM_SOCKET1_BUFFER_SIZE
+#define GSM_SOCKET1_BUFFER_SIZE GSM_SOCKET_BUFFER_SIZE
+#endif
+#ifndef GSM_SOCKET2_BUFFER_SIZE
+#define GSM_SOCKET2_BUFFER_SIZE GSM_SOCKET_BUFFER_SIZE
+#endif
 
-class GSM_Socket: public ModemUrcHandler{
+//read() min length meaning "wait for all the requested bytes"
+#define GSM_READ_ALL 0xFFFF
+
+//GPRS names a socket by a handle: the mux in the low bits, the generation of its pool slot above,
+//so a handle kept after its connection ended does not reach the next connection on the same mux
+#define GSM_SOCKET_MUX_BITS 2
+#define GSM_SOCKET_MUX_MASK ((1 << GSM_SOCKET_MUX_BITS) - 1)
+static_assert(MAX_SOCKETS <= GSM_SOCKET_MUX_MASK + 1, "the mux must fit in the low bits of a handle");
+
+//connection state of a socket, a connect started with GPRS::connectAsync() is settled by its URC
+enum GSM_SocketState {
+    GSM_SOCKET_CONNECTING,
+    GSM_SOCKET_OPEN,
+    GSM_SOCKET_FAILED,  //connect failed, or the bearer was lost
+    GSM_SOCKET_CLOSED   //closed by the peer: the data received before can still be read
+};
+
+//contiguous run of received bytes, owned by the socket buffer
+struct GSM_Span {
+    const uint8_t* data;
+    uint16_t len;
+};
+
+struct GSM_SocketPool;
+
+class GSM_Socket{
 
 public:
     friend class ModemClass;
     friend class GPRS;
+    friend class ModemReplay;
+    friend struct GSM_SocketPool;
+    //static RAM of the socket pool, buffers included
+    static uint32_t poolBytes();
+protected:
+    GSM_Socket(uint8_t mux, uint8_t* buffer, uint16_t size);
 private:
-    GSM_Socket(uint8_t mux);
-    bool close(unsigned long timeout = 1000L);
-    uint16_t read(void* buffer, uint16_t len = 1, unsigned long timeout = 1000L);
-    uint16_t send(const void * buff, uint16_t len);
-    void handleUrc(const void* urc, uint16_t len);
+    //the statically allocated socket of a mux, emptied and given a new generation
+    static GSM_Socket* acquire(uint8_t mux);
+    uint8_t handle() const { return _generation << GSM_SOCKET_MUX_BITS | _mux; }
+    int read(void* buffer, uint16_t len = 1, unsigned long timeout = 1000L, uint16_t minLen = GSM_READ_ALL);
+    uint16_t send(const void * buff, uint16_t len, bool wait = true);
+    uint16_t receive(ModemClass& modem, uint16_t len);
+    uint16_t available() const { return _head - _tail; }
+    bool connected() const { return _state == GSM_SOCKET_OPEN || _state == GSM_SOCKET_CONNECTING; }
+    uint8_t peek(GSM_Span spans[2]) const;
+    void consume(uint16_t len);
+    uint16_t copyOut(uint8_t* dst, uint16_t len);
     uint8_t _mux;
-    uint8_t _buffer[BUFFER_MAX];
-    uint8_t _freeIndex;
-    uint8_t _free;
+    uint8_t _generation; //never 0, so a bare mux number is not a valid handle
+    GSM_SocketState _state;
+    unsigned long _connectStart;
+    unsigned long _connectTimeout;
+    uint8_t* _buffer;
+    uint16_t _mask;
+    //free running indices: the buffer holds _head - _tail bytes, slot is index & _mask
+    uint16_t _head;
+    uint16_t _tail;
+    uint32_t _dropped;
+    uint16_t _failedSends; //CIPSENDs not confirmed by the modem, pipelined ones included
 };
 
-#endif
+template <uint16_t SIZE>
+class GSM_BufferedSocket: public GSM_Socket{
 
+    static_assert(SIZE >= 2 && SIZE <= 32768 && (SIZE & (SIZE - 1)) == 0, "socket buffer size must be a power of two");
+    friend struct GSM_SocketPool;
+    GSM_BufferedSocket(uint8_t mux): GSM_Socket(mux, _storage, SIZE) {}
+    uint8_t _storage[SIZE];
+};
+
+#endif
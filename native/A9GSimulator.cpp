@@ -0,0 +1,646 @@
+#include "A9GSimulator.h"
+
+#include <algorithm>
+#include <time.h>
+
+static const A9GSimConfig DEFAULT_CONFIG = {
+    5,      //latencyMs
+    0,      //jitterMs
+    0.0f,   //lossRate
+    0.0f,   //datagramLoss
+    500,    //attachMs
+    300,    //connectMs
+    150,    //remoteRttMs
+    460800, //stableBaud
+    true,   //asyncConnect
+    1       //seed
+};
+
+static bool startsWith(const std::string& s, const char* prefix)
+{
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+static std::string framed(const std::string& line)
+{
+    return "\r\n" + line + "\r\n";
+}
+
+static const char SIM_OK[] = "\r\nOK\r\n";
+static const char SIM_ERROR[] = "\r\nERROR\r\n";
+
+A9GSimulator::A9GSimulator():
+    _config(DEFAULT_CONFIG),
+    _rand(DEFAULT_CONFIG.seed),
+    _baud(115200),
+    _hostBaud(115200),
+    _savedBaud(115200),
+    _begun(false),
+    _echo(true),
+    _savedEcho(true),
+    _pinUnlocked(true),
+    _registration(1),
+    _cregMode(0),
+    _nextRegistration(1),
+    _registrationDue(0),
+    _signal(20),
+    _attached(false),
+    _ipState(IP_INITIAL),
+    _remoteEcho(true),
+    _clockUtc(1644257901UL),
+    _clockSet(0),
+    _clockZone(4),
+    _refuse(false),
+    _closeAfterReply(false),
+    _sendFailures(0),
+    _commands(0),
+    _latitude(45.4064),
+    _longitude(11.8768),
+    _altitude(12.0),
+    _gpsInterval(0),
+    _nextGps(0),
+    _gpsReports(0),
+    _sendMux(-1),
+    _sendLeft(0),
+    _swallowCtrlZ(false),
+    _skipLf(false),
+    _lastDue(0)
+{
+    for (int i = 0; i < 8; i++) _socks[i] = _udp[i] = false;
+}
+
+void A9GSimulator::configure(const A9GSimConfig& config)
+{
+    _config = config;
+    _rand = config.seed ? config.seed : 1;
+}
+
+void A9GSimulator::begin(unsigned long baud)
+{
+    _hostBaud = baud;
+    _begun = true;
+}
+
+void A9GSimulator::end()
+{
+    _begun = false;
+    _rx.clear();
+}
+
+void A9GSimulator::powerCycle()
+{
+    _baud = _savedBaud;
+    _echo = _savedEcho;
+    _pinUnlocked = _pin.empty();
+    _cregMode = 0;
+    _attached = false;
+    _ipState = IP_INITIAL;
+    for (int i = 0; i < 8; i++) _socks[i] = _udp[i] = false;
+    _gpsInterval = 0;
+    _line.clear();
+    _sendMux = -1;
+    _sendLeft = 0;
+    _sendData.clear();
+    _swallowCtrlZ = false;
+    _skipLf = false;
+    _rx.clear();
+    _later.clear();
+}
+
+int A9GSimulator::available()
+{
+    //bytes are queued in due order: count the ones whose time has come
+    unsigned long long now = ArduinoNative::now();
+    if (_gpsInterval && now >= _nextGps){
+        emitNmea();
+        _nextGps = now + 1000000ULL * _gpsInterval;
+    }
+    if (_registrationDue && now >= _registrationDue){
+        _registrationDue = 0;
+        _registration = _nextRegistration;
+        registrationChanged();
+    }
+    while (!_later.empty() && _later.begin()->first <= now){
+        emit(_later.begin()->second, now, true);
+        _later.erase(_later.begin());
+    }
+    std::deque<Byte>::iterator it = std::upper_bound(_rx.begin(), _rx.end(), now,
+        [](unsigned long long t, const Byte& b) { return t < b.due; });
+    return static_cast<int>(it - _rx.begin());
+}
+
+int A9GSimulator::read()
+{
+    if (_rx.empty() || _rx.front().due > ArduinoNative::now()) return -1;
+    uint8_t c = _rx.front().c;
+    _rx.pop_front();
+    return c;
+}
+
+int A9GSimulator::peek()
+{
+    if (_rx.empty() || _rx.front().due > ArduinoNative::now()) return -1;
+    return _rx.front().c;
+}
+
+size_t A9GSimulator::write(uint8_t c)
+{
+    if (!_begun || _hostBaud != _baud) return 1;
+
+    //line terminator following the command that opened data mode
+    if (_skipLf){
+        _skipLf = false;
+        if (c == '\n'){
+            if (_echo) emit(std::string(1, c), ArduinoNative::now(), false);
+            return 1;
+        }
+    }
+
+    //AT+CIPSEND data mode: payload bytes are not parsed as commands
+    if (_sendMux >= 0){
+        if (_echo) emit(std::string(1, c), ArduinoNative::now(), false);
+        if (_sendLeft == 0){
+            //no length given: payload terminated by ctrl-z
+            if (c != 0x1A){
+                _sendData += static_cast<char>(c);
+                return 1;
+            }
+        }
+        else{
+            _sendData += static_cast<char>(c);
+            if (--_sendLeft > 0) return 1;
+            _swallowCtrlZ = true;
+        }
+        uint8_t mux = _sendMux;
+        _sendMux = -1;
+        if (!_socks[mux] || (_sendFailures > 0 && _sendFailures--)){
+            reply(SIM_ERROR);
+        }
+        else if (_udp[mux]){
+            reply(SIM_OK);
+            if (!lost(_config.datagramLoss)){
+                receiveDatagram(mux, _sendData);
+            }
+        }
+        else{
+            _remote[mux] += _sendData;
+            _uplink += _sendData;
+            reply(SIM_OK);
+            if (_remoteEcho){
+                pushData(mux, _sendData.data(), _sendData.size());
+            }
+            if (_closeAfterReply){
+                closeRemote(mux);
+            }
+        }
+        _sendData.clear();
+        return 1;
+    }
+
+    if (_swallowCtrlZ){
+        _swallowCtrlZ = false;
+        if (c == 0x1A) return 1;
+    }
+
+    if (_echo) emit(std::string(1, c), ArduinoNative::now(), false);
+
+    if (c == '\r'){
+        std::string line = _line;
+        _line.clear();
+        _skipLf = true;
+        if (!line.empty()) handleCommand(line);
+    }
+    else if (c != '\n'){
+        _line += static_cast<char>(c);
+    }
+    return 1;
+}
+
+void A9GSimulator::script(const char* command, const char* reply)
+{
+    _script[command] = reply;
+}
+
+void A9GSimulator::clearScript()
+{
+    _script.clear();
+}
+
+void A9GSimulator::setPin(const char* pin)
+{
+    _pin = pin ? pin : "";
+    _pinUnlocked = _pin.empty();
+}
+
+void A9GSimulator::setRegistration(uint8_t stat, unsigned long afterMs)
+{
+    if (afterMs > 0){
+        _nextRegistration = stat;
+        _registrationDue = ArduinoNative::now() + 1000ULL * afterMs;
+        return;
+    }
+    _registrationDue = 0;
+    _registration = stat;
+    registrationChanged();
+}
+
+//serving cell given with the registration in AT+CREG=2 mode
+static const char SIM_CELL[] = ",\"5A2B\",\"0C3D\"";
+
+void A9GSimulator::registrationChanged()
+{
+    if (_cregMode == 0) return;
+    char buf[40];
+    snprintf(buf, sizeof(buf), "+CREG: %u%s", _registration,
+        _cregMode == 2 && (_registration == 1 || _registration == 5) ? SIM_CELL : "");
+    injectUrc(buf);
+}
+
+void A9GSimulator::setSignal(uint8_t rssi)
+{
+    _signal = rssi;
+}
+
+void A9GSimulator::setRemoteEcho(bool on)
+{
+    _remoteEcho = on;
+}
+
+void A9GSimulator::refuseConnections(bool refuse)
+{
+    _refuse = refuse;
+}
+
+void A9GSimulator::setClock(uint32_t utc, int8_t zone)
+{
+    _clockUtc = utc;
+    _clockSet = ArduinoNative::now();
+    _clockZone = zone;
+}
+
+uint32_t A9GSimulator::clock() const
+{
+    return _clockUtc + (ArduinoNative::now() - _clockSet) / 1000000ULL;
+}
+
+void A9GSimulator::setCloseAfterReply(bool on)
+{
+    _closeAfterReply = on;
+}
+
+void A9GSimulator::failSends(unsigned count)
+{
+    _sendFailures = count;
+}
+
+void A9GSimulator::closeRemote(uint8_t mux)
+{
+    if (mux >= 8 || !_socks[mux]) return;
+    _socks[mux] = false;
+    char line[16];
+    snprintf(line, sizeof(line), "%u, CLOSED", mux);
+    //kept behind the data pushed before, which is due after the remote round trip
+    emit(framed(line), ArduinoNative::now() + 1000ULL * (_config.remoteRttMs + jitter()), true);
+}
+
+void A9GSimulator::setPosition(double latitude, double longitude, double altitude)
+{
+    _latitude = latitude;
+    _longitude = longitude;
+    _altitude = altitude;
+}
+
+void A9GSimulator::pushData(uint8_t mux, const void* data, uint16_t len)
+{
+    char header[32];
+    snprintf(header, sizeof(header), "\r\n+CIPRCV,%u,%u:", mux, len);
+    std::string urc(header);
+    urc.append(reinterpret_cast<const char*>(data), len);
+    urc += "\r\n";
+    unsigned long long due = ArduinoNative::now() + 1000ULL * (_config.remoteRttMs + jitter());
+    emit(urc, due, true);
+}
+
+//the peer acks DatagramLink frames, other datagrams are echoed
+void A9GSimulator::receiveDatagram(uint8_t mux, const std::string& datagram)
+{
+    _remote[mux] += datagram;
+    _uplink += datagram;
+    _datagrams.push_back(datagram);
+    std::string response;
+    if (datagram.size() >= 4 && static_cast<uint8_t>(datagram[0]) == 0xA9 && datagram[1] == 0x01){
+        response = datagram.substr(0, 4);
+        response[1] = 0x02;
+    }
+    else if (_remoteEcho){
+        response = datagram;
+    }
+    if (!response.empty() && !lost(_config.datagramLoss)){
+        pushData(mux, response.data(), response.size());
+    }
+}
+
+void A9GSimulator::injectUrc(const char* line)
+{
+    emit(framed(line), ArduinoNative::now() + 1000ULL * jitter(), true);
+}
+
+void A9GSimulator::handleCommand(const std::string& line)
+{
+    _commands++;
+
+    std::map<std::string, std::string>::const_iterator it = _script.find(line);
+    if (it == _script.end()){
+        for (it = _script.begin(); it != _script.end(); ++it){
+            const std::string& key = it->first;
+            if (!key.empty() && key[key.size() - 1] == '*' && line.compare(0, key.size() - 1, key, 0, key.size() - 1) == 0){
+                break;
+            }
+        }
+    }
+    if (it != _script.end()){
+        reply(it->second);
+        return;
+    }
+    if (!handleBuiltin(line)){
+        reply(SIM_ERROR);
+    }
+}
+
+bool A9GSimulator::handleBuiltin(const std::string& line)
+{
+    char buf[64];
+
+    if (line == "AT" || line == "ATV1" || startsWith(line, "AT+CMEE=") || startsWith(line, "AT+CIPSPRT=")
+        || startsWith(line, "AT+CMGF=") || startsWith(line, "AT&F") || startsWith(line, "AT+AGPS=")
+        || line == "AT+GPS=1" || line == "AT+GPS=0" || startsWith(line, "AT+CIPMUX=")
+        || startsWith(line, "AT+CPOF") || startsWith(line, "AT+RST")){
+        reply(SIM_OK);
+    }
+    else if (line == "AT&W"){
+        _savedBaud = _baud;
+        _savedEcho = _echo;
+        reply(SIM_OK);
+    }
+    else if (startsWith(line, "AT+GPSRD=")){
+        _gpsInterval = strtoul(line.c_str() + 9, NULL, 10);
+        _nextGps = ArduinoNative::now() + 1000000ULL * _gpsInterval;
+        reply(SIM_OK);
+    }
+    else if (line == "ATE0" || line == "ATE1"){
+        _echo = line[3] == '1';
+        reply(SIM_OK);
+    }
+    else if (startsWith(line, "AT+IPR=")){
+        reply(SIM_OK);
+        _baud = strtoul(line.c_str() + 7, NULL, 10);
+    }
+    else if (line == "AT+CPIN?"){
+        reply(framed(_pinUnlocked ? "+CPIN: READY" : "+CPIN: SIM PIN") + SIM_OK);
+    }
+    else if (startsWith(line, "AT+CPIN=")){
+        std::string pin = line.substr(8);
+        if (pin.size() >= 2 && pin[0] == '"') pin = pin.substr(1, pin.size() - 2);
+        if (pin == _pin){
+            _pinUnlocked = true;
+            reply(SIM_OK);
+        }
+        else{
+            reply(framed("+CME ERROR: incorrect password"));
+        }
+    }
+    else if (line == "AT+CREG?"){
+        snprintf(buf, sizeof(buf), "+CREG: %u,%u%s", _cregMode, _registration,
+            _cregMode == 2 && (_registration == 1 || _registration == 5) ? SIM_CELL : "");
+        reply(framed(buf) + SIM_OK);
+    }
+    else if (startsWith(line, "AT+CREG=")){
+        _cregMode = strtoul(line.c_str() + 8, NULL, 10);
+        reply(_cregMode <= 2 ? SIM_OK : SIM_ERROR);
+    }
+    else if (line == "AT+CSQ"){
+        snprintf(buf, sizeof(buf), "+CSQ: %u,99", _signal);
+        reply(framed(buf) + SIM_OK);
+    }
+    else if (line == "AT+CCLK?"){
+        time_t local = clock() + _clockZone * 15 * 60;
+        struct tm tm;
+        gmtime_r(&local, &tm);
+        snprintf(buf, sizeof(buf), "+CCLK: \"%02d/%02d/%02d,%02d:%02d:%02d%+03d\"", tm.tm_year % 100, tm.tm_mon + 1,
+            tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, _clockZone);
+        reply(framed(buf) + SIM_OK);
+    }
+    else if (startsWith(line, "AT+CCLK=")){
+        struct tm tm = {};
+        int zone = 0;
+        if (sscanf(line.c_str() + 8, "\"%2d/%2d/%2d,%2d:%2d:%2d%3d\"", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour,
+            &tm.tm_min, &tm.tm_sec, &zone) != 7){
+            reply(SIM_ERROR);
+        }
+        else{
+            tm.tm_year += 100;
+            tm.tm_mon -= 1;
+            setClock(timegm(&tm) - zone * 15 * 60, zone);
+            reply(SIM_OK);
+        }
+    }
+    else if (startsWith(line, "AT+CGATT=")){
+        _attached = line[9] == '1';
+        if (!_attached) _ipState = IP_INITIAL;
+        reply(SIM_OK, _attached ? _config.attachMs / 5 : 0);
+    }
+    else if (startsWith(line, "AT+CSTT=")){
+        if (_ipState != IP_INITIAL){
+            reply(SIM_ERROR);
+        }
+        else{
+            _ipState = IP_START;
+            reply(SIM_OK);
+        }
+    }
+    else if (line == "AT+CIPSTATUS"){
+        static const char* const states[] = {"IP INITIAL", "IP START", "IP GPRSACT"};
+        reply(framed(std::string("STATE: ") + states[_ipState]) + SIM_OK);
+    }
+    else if (line == "AT+CGATT?"){
+        reply(framed(_attached ? "+CGATT: 1" : "+CGATT: 0") + SIM_OK);
+    }
+    else if (line == "AT+CIICR"){
+        if (_ipState != IP_START){
+            reply(SIM_ERROR);
+        }
+        else{
+            _attached = true;
+            _ipState = IP_GPRSACT;
+            reply(SIM_OK, _config.attachMs);
+        }
+    }
+    else if (line == "AT+CIPSHUT"){
+        _ipState = IP_INITIAL;
+        for (int i = 0; i < 8; i++) _socks[i] = _udp[i] = false;
+        reply(SIM_OK);
+    }
+    else if (startsWith(line, "AT+CIFSR")){
+        reply(framed("10.64.12.7") + SIM_OK);
+    }
+    else if (startsWith(line, "AT+CIPSTART=")){
+        bool udp = startsWith(line, "AT+CIPSTART=\"UDP\"");
+        //no handshake for UDP
+        unsigned long connectMs = udp ? 0 : _config.connectMs;
+        int mux = -1;
+        for (int i = 0; i < 8; i++){
+            if (!_socks[i]){
+                mux = i;
+                break;
+            }
+        }
+        if (mux < 0){
+            reply(framed("CONNECT FAIL") + SIM_OK, connectMs);
+        }
+        else if (_config.asyncConnect){
+            //the mux is given back by the modem if the connect fails
+            _socks[mux] = !_refuse;
+            _udp[mux] = udp;
+            snprintf(buf, sizeof(buf), "+CIPNUM:%d", mux);
+            reply(framed(buf) + SIM_OK);
+            snprintf(buf, sizeof(buf), "%d, %s", mux, _refuse ? "CONNECT FAIL" : "CONNECT OK");
+            replyLater(framed(buf), connectMs);
+        }
+        else if (_refuse){
+            reply(framed("CONNECT FAIL") + SIM_OK, connectMs);
+        }
+        else{
+            _socks[mux] = true;
+            _udp[mux] = udp;
+            snprintf(buf, sizeof(buf), "+CIPNUM:%d", mux);
+            reply(framed(buf) + framed("CONNECT OK") + SIM_OK, connectMs);
+        }
+    }
+    else if (startsWith(line, "AT+CIPSEND=")){
+        unsigned int mux = 0;
+        unsigned int len = 0;
+        if (sscanf(line.c_str() + 11, "%u,%u", &mux, &len) < 1 || mux >= 8){
+            reply(SIM_ERROR);
+        }
+        else{
+            _sendMux = mux;
+            _sendLeft = len;
+            _sendData.clear();
+        }
+    }
+    else if (startsWith(line, "AT+CIPCLOSE=")){
+        unsigned int mux = strtoul(line.c_str() + 12, NULL, 10);
+        if (mux < 8 && _socks[mux]){
+            _socks[mux] = false;
+            reply(SIM_OK);
+        }
+        else{
+            reply(SIM_ERROR);
+        }
+    }
+    else{
+        return false;
+    }
+    return true;
+}
+
+void A9GSimulator::reply(const std::string& bytes, unsigned long extraMs)
+{
+    unsigned long long due = ArduinoNative::now() + 1000ULL * (_config.latencyMs + extraMs + jitter());
+    emit(bytes, due, true);
+}
+
+void A9GSimulator::replyLater(const std::string& bytes, unsigned long extraMs)
+{
+    unsigned long long due = ArduinoNative::now() + 1000ULL * (_config.latencyMs + extraMs + jitter());
+    _later.insert(std::make_pair(due, bytes));
+}
+
+void A9GSimulator::emit(const std::string& bytes, unsigned long long due, bool lossy)
+{
+    if (lossy && lost(_config.lossRate)) return;
+    //keep the stream in order and paced at the line rate: 10 bits per byte
+    unsigned long long byteMicros = 10000000ULL / (_baud ? _baud : 115200);
+    for (size_t i = 0; i < bytes.size(); i++){
+        due = std::max(due, _lastDue + byteMicros);
+        uint8_t c = bytes[i];
+        if (_hostBaud != _baud){
+            c ^= 0xA5; //framing garbage
+        }
+        else if (_baud > _config.stableBaud && corrupted()){
+            c ^= 1 << (_rand % 8);
+        }
+        Byte b = {due, c};
+        _rx.push_back(b);
+        _lastDue = due;
+    }
+}
+
+static std::string nmeaSentence(const char* body)
+{
+    uint8_t checksum = 0;
+    for (const char* p = body; *p; p++) checksum ^= static_cast<uint8_t>(*p);
+    char tail[8];
+    snprintf(tail, sizeof(tail), "*%02X", checksum);
+    return std::string("$") + body + tail;
+}
+
+static void nmeaCoordinate(double value, int degreeDigits, char* out, size_t size)
+{
+    value = fabs(value);
+    int degrees = static_cast<int>(value);
+    snprintf(out, size, "%0*d%07.4f", degreeDigits, degrees, (value - degrees) * 60.0);
+}
+
+void A9GSimulator::emitNmea()
+{
+    //about 11 m north-east per report
+    double latitude = _latitude + _gpsReports * 1e-4;
+    double longitude = _longitude + _gpsReports * 1e-4;
+    unsigned long seconds = 69501UL + _gpsReports * _gpsInterval; //19:18:21 onwards
+    _gpsReports++;
+
+    char lat[32], lon[32], body[160];
+    nmeaCoordinate(latitude, 2, lat, sizeof(lat));
+    nmeaCoordinate(longitude, 3, lon, sizeof(lon));
+    char hhmmss[8];
+    snprintf(hhmmss, sizeof(hhmmss), "%02lu%02lu%02lu", (seconds / 3600) % 24, (seconds / 60) % 60, seconds % 60);
+
+    snprintf(body, sizeof(body), "GPGGA,%s.00,%s,%c,%s,%c,1,08,0.9,%.1f,M,47.0,M,,",
+        hhmmss, lat, latitude < 0 ? 'S' : 'N', lon, longitude < 0 ? 'W' : 'E', _altitude);
+    std::string report = framed("+GPSRD:" + nmeaSentence(body));
+    snprintf(body, sizeof(body), "GPRMC,%s.00,A,%s,%c,%s,%c,1.20,45.00,070222,,,A",
+        hhmmss, lat, latitude < 0 ? 'S' : 'N', lon, longitude < 0 ? 'W' : 'E');
+    report += nmeaSentence(body) + "\r\n";
+    emit(report, ArduinoNative::now() + 1000ULL * jitter(), true);
+}
+
+unsigned long A9GSimulator::jitter()
+{
+    if (_config.jitterMs == 0) return 0;
+    //xorshift32
+    _rand ^= _rand << 13;
+    _rand ^= _rand >> 17;
+    _rand ^= _rand << 5;
+    return _rand % (_config.jitterMs + 1);
+}
+
+bool A9GSimulator::corrupted()
+{
+    _rand ^= _rand << 13;
+    _rand ^= _rand >> 17;
+    _rand ^= _rand << 5;
+    return _rand % 200 == 0;
+}
+
+bool A9GSimulator::lost(float rate)
+{
+    if (rate <= 0.0f) return false;
+    _rand ^= _rand << 13;
+    _rand ^= _rand >> 17;
+    _rand ^= _rand << 5;
+    return (_rand % 10000) < static_cast<uint32_t>(rate * 10000);
+}
+
+A9GSimulator A9G_SIM;
+Uart& Serial1 = A9G_SIM;
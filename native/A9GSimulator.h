@@ -0,0 +1,190 @@
+#ifndef _A9G_SIMULATOR_H_INCLUDED
+#define _A9G_SIMULATOR_H_INCLUDED
+
+#include <Arduino.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+/*Scripted A9G modem living behind the Uart interface, for host builds.
+
+    Commands written by the driver are parsed line by line and answered with the byte stream
+    the real module would produce (echo, verbose result codes, +CIPRCV chunks). Every reply is
+    scheduled on the virtual clock: it becomes readable after latency + random jitter, paced at
+    the configured baud rate, and can be dropped altogether with the configured loss rate.
+
+    After AT+GPSRD=<n> a GGA/RMC pair is reported every n seconds, walking north-east from
+    the position set with setPosition().
+
+    After AT+CREG=1 or 2 every setRegistration() change is reported as a +CREG URC, with the
+    serving cell in mode 2.
+
+    The RTC read with AT+CCLK? starts at 22/02/07,19:18:21+04 and runs with the virtual clock.
+
+    The modem starts at 115200 and moves with AT+IPR; while the rate given to begin() differs,
+    what the driver writes is lost and what the modem sends arrives garbled. AT&W saves the rate
+    and the echo mode, powerCycle() restarts the modem from them.
+
+    AT+CIPSTART answers with the mux right away and reports "<mux>, CONNECT OK" later as a URC, or
+    with config.asyncConnect off holds the response until the connect result, CONNECT OK included.
+    A "UDP" connect has no handshake and settles without config.connectMs. On a UDP mux every
+    AT+CIPSEND is a datagram, lost on the way up or back with config.datagramLoss; the peer acks
+    the frames of DatagramLink.h like a collecting server and echoes any other datagram.
+
+    Built-in replies cover AT+CPIN?, AT+CREG?, AT+CGATT, AT+CIPSTART, AT+CIPSEND, AT+CIPCLOSE and
+    the other commands issued by the driver; script() overrides or extends them.
+*/
+
+struct A9GSimConfig {
+    unsigned long latencyMs;    //delay between the end of a command and the first byte of its reply
+    unsigned long jitterMs;     //uniformly distributed extra delay added to each reply
+    float lossRate;             //probability that a reply or URC is never delivered
+    float datagramLoss;         //probability that a UDP datagram, or its reply, is lost in the network
+    unsigned long attachMs;     //extra time taken by AT+CIICR
+    unsigned long connectMs;    //extra time taken by AT+CIPSTART
+    unsigned long remoteRttMs;  //round trip to the remote peer for data sent with AT+CIPSEND
+    unsigned long stableBaud;   //above this rate 1 byte in 200 sent by the modem is corrupted
+    bool asyncConnect;          //AT+CIPSTART answers at once, "<mux>, CONNECT OK" follows as a URC
+    uint32_t seed;
+};
+
+class A9GSimulator : public Uart {
+
+public:
+    A9GSimulator();
+
+    void configure(const A9GSimConfig& config);
+    const A9GSimConfig& config() const { return _config; }
+
+    //Uart
+    void begin(unsigned long baud);
+    void end();
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t c);
+    using Print::write;
+    void flush() {}
+
+    /** Reply to a command with a fixed byte stream instead of the built-in behaviour
+      @param command     full command line (without line terminator), or a prefix ending with '*'
+      @param reply       raw bytes sent back, including framing, e.g. "\r\n+CSQ: 5,0\r\n\r\nOK\r\n"
+    */
+    void script(const char* command, const char* reply);
+    void clearScript();
+
+    void setPin(const char* pin);
+    //+CREG <stat>, from afterMs from now; reported as a URC after AT+CREG=1 or 2
+    void setRegistration(uint8_t stat, unsigned long afterMs = 0);
+    void setSignal(uint8_t rssi);
+    //when on, data sent on a socket is echoed back by the remote peer as +CIPRCV
+    void setRemoteEcho(bool on);
+    void refuseConnections(bool refuse);
+    //when on, the remote peer closes a TCP connection once it has answered data sent on it, like an HTTP/1.0 server
+    void setCloseAfterReply(bool on);
+    //the next count AT+CIPSEND payloads are answered ERROR, as when the network drops them
+    void failSends(unsigned count);
+    //remote peer closes the connection: "<mux>, CLOSED", after the data already on its way
+    void closeRemote(uint8_t mux);
+    //modem RTC, keeps running on the virtual clock; zone in quarters of an hour
+    void setClock(uint32_t utc, int8_t zone);
+    uint32_t clock() const;
+    //starting point of the simulated GPS track, in degrees and meters
+    void setPosition(double latitude, double longitude, double altitude);
+
+    //power off and on: the rate and echo mode come from the profile, connections and settings are gone
+    void powerCycle();
+
+    //remote peer sends data on an open socket
+    void pushData(uint8_t mux, const void* data, uint16_t len);
+    //unsolicited line, framed as "\r\n<line>\r\n"
+    void injectUrc(const char* line);
+
+    bool echo() const { return _echo; }
+    bool bearerUp() const { return _ipState == IP_GPRSACT; }
+    unsigned long baud() const { return _baud; }
+    //rate and echo mode saved with AT&W
+    unsigned long savedBaud() const { return _savedBaud; }
+    bool savedEcho() const { return _savedEcho; }
+    unsigned long commands() const { return _commands; }
+    //bytes the remote peer received on a socket
+    const std::string& received(uint8_t mux) { return _remote[mux]; }
+    //bytes received on all the sockets, in order: a mux left open by a lost reply moves the next ones
+    const std::string& received() const { return _uplink; }
+    //datagrams the remote peers received on UDP sockets, in order
+    const std::vector<std::string>& datagrams() const { return _datagrams; }
+
+private:
+    void handleCommand(const std::string& line);
+    bool handleBuiltin(const std::string& line);
+    void reply(const std::string& bytes, unsigned long extraMs = 0);
+    //unsolicited output sent extraMs from now, other replies can go out in the meantime
+    void replyLater(const std::string& bytes, unsigned long extraMs);
+    void emit(const std::string& bytes, unsigned long long due, bool lossy);
+    unsigned long jitter();
+    bool lost(float rate);
+    void receiveDatagram(uint8_t mux, const std::string& datagram);
+    bool corrupted();
+    void emitNmea();
+    void registrationChanged();
+
+    A9GSimConfig _config;
+    uint32_t _rand;
+    unsigned long _baud;
+    unsigned long _hostBaud;
+    unsigned long _savedBaud;
+    bool _begun;
+    bool _echo;
+    bool _savedEcho;
+    std::string _pin;
+    bool _pinUnlocked;
+    uint8_t _registration;
+    uint8_t _cregMode;
+    uint8_t _nextRegistration;
+    unsigned long long _registrationDue; //0 if no change pending
+    uint8_t _signal;
+    bool _attached;
+    enum {IP_INITIAL, IP_START, IP_GPRSACT} _ipState; //as reported by AT+CIPSTATUS
+    bool _remoteEcho;
+    uint32_t _clockUtc;             //RTC time at _clockSet
+    unsigned long long _clockSet;
+    int8_t _clockZone;
+    bool _refuse;
+    bool _closeAfterReply;
+    unsigned _sendFailures;
+    bool _socks[8];
+    bool _udp[8];
+    unsigned long _commands;
+    double _latitude;
+    double _longitude;
+    double _altitude;
+    unsigned long _gpsInterval;
+    unsigned long long _nextGps;
+    unsigned long _gpsReports;
+
+    std::string _line;
+    //AT+CIPSEND data mode
+    int _sendMux;
+    uint16_t _sendLeft;
+    std::string _sendData;
+    bool _swallowCtrlZ;
+    bool _skipLf;
+
+    std::map<std::string, std::string> _script;
+    std::map<uint8_t, std::string> _remote;
+    std::string _uplink;
+    std::vector<std::string> _datagrams;
+    struct Byte {
+        unsigned long long due;
+        uint8_t c;
+    };
+    std::deque<Byte> _rx;
+    unsigned long long _lastDue;
+    std::multimap<unsigned long long, std::string> _later;
+};
+
+extern A9GSimulator A9G_SIM;
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef _NATIVE_ARDUINO_H_INCLUDED
+#define _NATIVE_ARDUINO_H_INCLUDED
+
+/*Minimal host implementation of the Arduino API used by the driver.
+    Only what src/ needs is provided: String, Print/Stream, Uart, timing and pin stubs.
+
+    Time is virtual: every call to millis()/micros() advances the clock by a small tick
+    (see ArduinoNative::setTickMicros) and delay() jumps ahead instantly, so busy-wait
+    loops and timeouts behave deterministically and run at full host speed.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <type_traits>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define DEC 10
+#define HEX 16
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(PSTR(string_literal)))
+
+template <typename A, typename B>
+inline typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+template <typename A, typename B>
+inline typename std::common_type<A, B>::type max(A a, B b) { return a > b ? a : b; }
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+namespace ArduinoNative {
+    //virtual microseconds added by each millis()/micros() call
+    void setTickMicros(unsigned long us);
+    //absolute virtual time, in microseconds
+    unsigned long long now();
+    //last level written to a pin by digitalWrite()
+    uint8_t pinLevel(uint8_t pin);
+}
+
+class String {
+public:
+    String(const char* cstr = "") : _s(cstr ? cstr : "") {}
+    String(const String& str) : _s(str._s) {}
+    String(const __FlashStringHelper* str) : _s(reinterpret_cast<const char*>(str)) {}
+    explicit String(char c) : _s(1, c) {}
+    explicit String(int value, unsigned char base = 10);
+    explicit String(unsigned int value, unsigned char base = 10);
+    explicit String(long value, unsigned char base = 10);
+    explicit String(unsigned long value, unsigned char base = 10);
+
+    String& operator=(const String& rhs) { _s = rhs._s; return *this; }
+    String& operator=(const char* cstr) { _s = cstr ? cstr : ""; return *this; }
+
+    unsigned char reserve(unsigned int size) { _s.reserve(size); return 1; }
+    unsigned int length() const { return _s.length(); }
+    const char* c_str() const { return _s.c_str(); }
+
+    unsigned char concat(const String& str) { _s += str._s; return 1; }
+    unsigned char concat(const char* cstr) { _s += cstr; return 1; }
+    unsigned char concat(char c) { _s += c; return 1; }
+    String& operator+=(const String& rhs) { concat(rhs); return *this; }
+    String& operator+=(const char* cstr) { concat(cstr); return *this; }
+    String& operator+=(char c) { concat(c); return *this; }
+
+    unsigned char equals(const char* cstr) const { return _s == cstr; }
+    bool operator==(const String& rhs) const { return _s == rhs._s; }
+    bool operator==(const char* cstr) const { return _s == cstr; }
+    bool operator!=(const String& rhs) const { return _s != rhs._s; }
+    bool operator!=(const char* cstr) const { return _s != cstr; }
+
+    unsigned char startsWith(const String& prefix) const { return _s.compare(0, prefix._s.length(), prefix._s) == 0; }
+    unsigned char endsWith(const String& suffix) const;
+    char charAt(unsigned int index) const { return index < _s.length() ? _s[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+
+    int indexOf(char ch, unsigned int fromIndex = 0) const;
+    int indexOf(const String& str, unsigned int fromIndex = 0) const;
+    int indexOf(const char* str, unsigned int fromIndex = 0) const;
+    String substring(unsigned int beginIndex) const;
+    String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+    void trim();
+    long toInt() const { return atol(_s.c_str()); }
+
+    friend String operator+(const String& lhs, const String& rhs);
+    friend String operator+(const char* lhs, const String& rhs);
+    friend String operator+(const String& lhs, const char* rhs);
+
+private:
+    std::string _s;
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* str) { return str ? write(reinterpret_cast<const uint8_t*>(str), strlen(str)) : 0; }
+    virtual void flush() {}
+
+    size_t print(const __FlashStringHelper* str) { return write(reinterpret_cast<const char*>(str)); }
+    size_t print(const String& str) { return write(reinterpret_cast<const uint8_t*>(str.c_str()), str.length()); }
+    size_t print(const char* str) { return write(str); }
+    size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+    size_t print(unsigned char n, int base = DEC) { return print(static_cast<unsigned long>(n), base); }
+    size_t print(int n, int base = DEC) { return print(static_cast<long>(n), base); }
+    size_t print(unsigned int n, int base = DEC) { return print(static_cast<unsigned long>(n), base); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(long long n, int base = DEC) { return print(static_cast<long>(n), base); }
+    size_t print(unsigned long long n, int base = DEC) { return print(static_cast<unsigned long>(n), base); }
+    size_t print(double n, int digits = 2);
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(T value) { size_t n = print(value); return n + println(); }
+    template <typename T>
+    size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+};
+
+class Stream : public Print {
+public:
+    Stream() : _timeout(1000) {}
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    size_t readBytes(char* buffer, size_t length);
+    size_t readBytes(uint8_t* buffer, size_t length) { return readBytes(reinterpret_cast<char*>(buffer), length); }
+    size_t readBytesUntil(char terminator, char* buffer, size_t length);
+
+protected:
+    int timedRead();
+    unsigned long _timeout;
+};
+
+class Uart : public Stream {
+public:
+    virtual void begin(unsigned long baud) { (void) baud; }
+    virtual void end() {}
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    virtual size_t write(uint8_t c) { (void) c; return 1; }
+    using Print::write;
+    operator bool() { return true; }
+};
+
+//host console, written to stdout
+class NativeConsole : public Uart {
+public:
+    size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+    using Print::write;
+    void flush() { fflush(stdout); }
+};
+
+extern NativeConsole SerialUSB;
+extern Uart& Serial1;
+
+#endif
@@ -0,0 +1,225 @@
+#include <Arduino.h>
+
+namespace {
+unsigned long long virtualMicros = 0;
+unsigned long tickMicros = 100;
+uint8_t pinLevels[256] = {0};
+}
+
+namespace ArduinoNative {
+void setTickMicros(unsigned long us)
+{
+    tickMicros = us;
+}
+
+unsigned long long now()
+{
+    return virtualMicros;
+}
+
+uint8_t pinLevel(uint8_t pin)
+{
+    return pinLevels[pin];
+}
+}
+
+unsigned long millis()
+{
+    virtualMicros += tickMicros;
+    return static_cast<unsigned long>(virtualMicros / 1000);
+}
+
+unsigned long micros()
+{
+    virtualMicros += tickMicros;
+    return static_cast<unsigned long>(virtualMicros);
+}
+
+void delay(unsigned long ms)
+{
+    virtualMicros += 1000ULL * ms;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    virtualMicros += us;
+}
+
+void yield()
+{
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    (void) pin;
+    (void) mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    pinLevels[pin] = val;
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pinLevels[pin];
+}
+
+//############################################################################ String
+
+static std::string toBase(unsigned long value, unsigned char base, bool negative)
+{
+    char buf[8 * sizeof(long) + 2];
+    char* p = buf + sizeof(buf) - 1;
+    *p = '\0';
+    if (base < 2) base = 10;
+    do {
+        unsigned long digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        value /= base;
+    } while (value);
+    if (negative) *--p = '-';
+    return std::string(p);
+}
+
+String::String(int value, unsigned char base) : _s(toBase(value < 0 && base == 10 ? -(long) value : (unsigned int) value, base, value < 0 && base == 10)) {}
+String::String(unsigned int value, unsigned char base) : _s(toBase(value, base, false)) {}
+String::String(long value, unsigned char base) : _s(toBase(value < 0 && base == 10 ? -value : value, base, value < 0 && base == 10)) {}
+String::String(unsigned long value, unsigned char base) : _s(toBase(value, base, false)) {}
+
+unsigned char String::endsWith(const String& suffix) const
+{
+    if (suffix._s.length() > _s.length()) return 0;
+    return _s.compare(_s.length() - suffix._s.length(), suffix._s.length(), suffix._s) == 0;
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const
+{
+    size_t pos = _s.find(ch, fromIndex);
+    return pos == std::string::npos ? -1 : static_cast<int>(pos);
+}
+
+int String::indexOf(const String& str, unsigned int fromIndex) const
+{
+    size_t pos = _s.find(str._s, fromIndex);
+    return pos == std::string::npos ? -1 : static_cast<int>(pos);
+}
+
+int String::indexOf(const char* str, unsigned int fromIndex) const
+{
+    size_t pos = _s.find(str, fromIndex);
+    return pos == std::string::npos ? -1 : static_cast<int>(pos);
+}
+
+String String::substring(unsigned int beginIndex) const
+{
+    return substring(beginIndex, _s.length());
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const
+{
+    if (beginIndex > endIndex) {
+        unsigned int tmp = beginIndex;
+        beginIndex = endIndex;
+        endIndex = tmp;
+    }
+    if (beginIndex >= _s.length()) return String();
+    if (endIndex > _s.length()) endIndex = _s.length();
+    String out;
+    out._s = _s.substr(beginIndex, endIndex - beginIndex);
+    return out;
+}
+
+void String::trim()
+{
+    size_t begin = 0;
+    size_t end = _s.length();
+    while (begin < end && isspace(static_cast<unsigned char>(_s[begin]))) begin++;
+    while (end > begin && isspace(static_cast<unsigned char>(_s[end - 1]))) end--;
+    _s = _s.substr(begin, end - begin);
+}
+
+String operator+(const String& lhs, const String& rhs)
+{
+    String out(lhs);
+    out._s += rhs._s;
+    return out;
+}
+
+String operator+(const char* lhs, const String& rhs)
+{
+    return String(lhs) + rhs;
+}
+
+String operator+(const String& lhs, const char* rhs)
+{
+    return lhs + String(rhs);
+}
+
+//############################################################################ Print / Stream
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--) {
+        if (write(*buffer++)) n++;
+        else break;
+    }
+    return n;
+}
+
+size_t Print::print(long n, int base)
+{
+    if (base == 10 && n < 0) {
+        return print('-') + print(static_cast<unsigned long>(-n), base);
+    }
+    return print(static_cast<unsigned long>(n), base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    return print(String(n, static_cast<unsigned char>(base)));
+}
+
+size_t Print::print(double n, int digits)
+{
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return print(buf);
+}
+
+int Stream::timedRead()
+{
+    unsigned long start = millis();
+    do {
+        int c = read();
+        if (c >= 0) return c;
+    } while (millis() - start < _timeout);
+    return -1;
+}
+
+size_t Stream::readBytes(char* buffer, size_t length)
+{
+    size_t count = 0;
+    while (count < length) {
+        int c = timedRead();
+        if (c < 0) break;
+        *buffer++ = static_cast<char>(c);
+        count++;
+    }
+    return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char* buffer, size_t length)
+{
+    size_t index = 0;
+    while (index < length) {
+        int c = timedRead();
+        if (c < 0 || c == terminator) break;
+        *buffer++ = static_cast<char>(c);
+        index++;
+    }
+    return index;
+}
+
+NativeConsole SerialUSB;
@@ -0,0 +1,85 @@
+#include "FileFlash.h"
+
+#include <algorithm>
+
+FileFlash::FileFlash(const char* path, uint32_t size, uint16_t pageSize, uint16_t rowSize):
+    _path(path),
+    _size(size - size % rowSize),
+    _pageSize(pageSize),
+    _rowSize(rowSize),
+    _data(_size, 0xFF),
+    _rowErases(_size / rowSize, 0),
+    _writes(0),
+    _erases(0),
+    _tear(false)
+{
+    FILE* f = fopen(path, "rb");
+    if (f != NULL){
+        size_t got = fread(_data.data(), 1, _size, f);
+        fclose(f);
+        if (got == _size) return;
+    }
+    //new device: erased
+    std::fill(_data.begin(), _data.end(), 0xFF);
+    sync(0, _size);
+}
+
+void FileFlash::read(uint32_t address, void* data, uint16_t len)
+{
+    if (address + len > _size) return;
+    memcpy(data, _data.data() + address, len);
+}
+
+bool FileFlash::write(uint32_t address, const void* data, uint16_t len)
+{
+    if (len == 0 || address + len > _size || address / _pageSize != (address + len - 1) / _pageSize){
+        return false;
+    }
+    _writes++;
+    delayMicroseconds(FILE_FLASH_WRITE_US);
+    uint16_t programmed = _tear ? len / 2 : len;
+    _tear = false;
+    const uint8_t* in = static_cast<const uint8_t*>(data);
+    for (uint16_t i = 0; i < programmed; i++){
+        _data[address + i] &= in[i];
+    }
+    sync(address, len);
+    return memcmp(_data.data() + address, in, len) == 0;
+}
+
+bool FileFlash::erase(uint32_t address)
+{
+    if (address >= _size) return false;
+    address -= address % _rowSize;
+    _erases++;
+    _rowErases[address / _rowSize]++;
+    delayMicroseconds(FILE_FLASH_ERASE_US);
+    memset(_data.data() + address, 0xFF, _rowSize);
+    sync(address, _rowSize);
+    return true;
+}
+
+unsigned long FileFlash::maxRowErases() const
+{
+    return *std::max_element(_rowErases.begin(), _rowErases.end());
+}
+
+unsigned long FileFlash::minRowErases() const
+{
+    return *std::min_element(_rowErases.begin(), _rowErases.end());
+}
+
+void FileFlash::sync(uint32_t address, uint32_t len)
+{
+    FILE* f = fopen(_path.c_str(), "r+b");
+    if (f == NULL) f = fopen(_path.c_str(), "w+b");
+    if (f == NULL) return;
+    if (address == 0 && len == _size){
+        fwrite(_data.data(), 1, _size, f);
+    }
+    else{
+        fseek(f, address, SEEK_SET);
+        fwrite(_data.data() + address, 1, len, f);
+    }
+    fclose(f);
+}
@@ -0,0 +1,59 @@
+#ifndef _FILE_FLASH_H_INCLUDED
+#define _FILE_FLASH_H_INCLUDED
+
+#include <Arduino.h>
+
+#include <string>
+#include <vector>
+
+#include "FlashDevice.h"
+
+/*File-backed NOR flash with the SAMD21 NVM geometry and timing, for host builds.
+
+    Programming ANDs the data into the page like the real array, page writes and row erases
+    advance the virtual clock by their datasheet duration, and every row keeps an erase count
+    so wear leveling can be checked. The file persists across runs: a new instance on the same
+    path is a reboot.
+*/
+
+//SAMD21 datasheet, NVM characteristics (max values)
+#define FILE_FLASH_WRITE_US 2500
+#define FILE_FLASH_ERASE_US 6000
+
+class FileFlash : public FlashDevice {
+
+public:
+    FileFlash(const char* path, uint32_t size, uint16_t pageSize = 64, uint16_t rowSize = 256);
+
+    uint32_t size() const { return _size; }
+    uint16_t pageSize() const { return _pageSize; }
+    uint16_t rowSize() const { return _rowSize; }
+
+    void read(uint32_t address, void* data, uint16_t len);
+    bool write(uint32_t address, const void* data, uint16_t len);
+    bool erase(uint32_t address);
+
+    //power loss during the next write: only its first half reaches the array
+    void tearNextWrite() { _tear = true; }
+
+    unsigned long writes() const { return _writes; }
+    unsigned long erases() const { return _erases; }
+    unsigned long rowErases(uint32_t row) const { return _rowErases[row]; }
+    unsigned long maxRowErases() const;
+    unsigned long minRowErases() const;
+
+private:
+    void sync(uint32_t address, uint32_t len);
+
+    std::string _path;
+    uint32_t _size;
+    uint16_t _pageSize;
+    uint16_t _rowSize;
+    std::vector<uint8_t> _data;
+    std::vector<unsigned long> _rowErases;
+    unsigned long _writes;
+    unsigned long _erases;
+    bool _tear;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _NATIVE_IPADDRESS_H_INCLUDED
+#define _NATIVE_IPADDRESS_H_INCLUDED
+
+#include <Arduino.h>
+
+class IPAddress {
+public:
+    IPAddress() { memset(_address, 0, sizeof(_address)); }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    {
+        _address[0] = a;
+        _address[1] = b;
+        _address[2] = c;
+        _address[3] = d;
+    }
+
+    bool fromString(const String& address) { return fromString(address.c_str()); }
+    bool fromString(const char* address)
+    {
+        uint16_t acc = 0;
+        uint8_t dots = 0;
+        bool digit = false;
+        for (; *address; address++) {
+            char c = *address;
+            if (c >= '0' && c <= '9') {
+                acc = acc * 10 + (c - '0');
+                if (acc > 255) return false;
+                digit = true;
+            } else if (c == '.' && digit && dots < 3) {
+                _address[dots++] = acc;
+                acc = 0;
+                digit = false;
+            } else {
+                return false;
+            }
+        }
+        if (dots != 3 || !digit) return false;
+        _address[3] = acc;
+        return true;
+    }
+
+    uint8_t operator[](int index) const { return _address[index]; }
+    bool operator==(const IPAddress& rhs) const { return memcmp(_address, rhs._address, sizeof(_address)) == 0; }
+
+private:
+    uint8_t _address[4];
+};
+
+#endif
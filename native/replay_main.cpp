@@ -0,0 +1,288 @@
+/*Replay benchmark: feeds a UART capture (see ModemCapture.h) through ModemClass::poll(), the socket
+    buffers and the URC handlers, and reports the host cost of parsing it.
+
+    RX bytes become readable at their captured time on the virtual clock. TX command lines are
+    issued again with MODEM.send(), so that the parser sees the same command/echo/response
+    sequence as on the device; other TX bytes (socket payloads) are written raw. The application
+    side is stood in for by a handler subscribed to every URC and by draining all sockets after
+    each poll().
+
+    usage: replay <transcript> [--repeat n]
+*/
+
+#include <A9GLib.h>
+#include <new>
+#include <time.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define REPLAY_CYCLES() __rdtsc()
+#else
+#define REPLAY_CYCLES() 0ULL
+#endif
+
+#include "NMEAParser.h"
+
+//heap allocations made while the driver is being measured
+static bool countAllocations = false;
+static unsigned long allocations = 0;
+
+void* operator new(size_t size)
+{
+    if (countAllocations) allocations++;
+    void* p = malloc(size ? size : 1);
+    if (p == NULL) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+struct ReplayRecord {
+    bool tx;
+    unsigned long ms;
+    std::string bytes;
+};
+
+//UART whose RX side serves the captured bytes once the virtual clock reaches their time
+class ReplayUart : public Uart {
+public:
+    ReplayUart() : _next(0), _ready(0), _written(0) {}
+    void schedule(unsigned long long due, const std::string& bytes)
+    {
+        for (size_t i = 0; i < bytes.size(); i++){
+            Byte b = {due, static_cast<uint8_t>(bytes[i])};
+            _rx.push_back(b);
+        }
+    }
+    int available()
+    {
+        unsigned long long now = ArduinoNative::now();
+        while (_ready < _rx.size() && _rx[_ready].due <= now) _ready++;
+        return _ready - _next;
+    }
+    int read() { return available() ? _rx[_next++].c : -1; }
+    int peek() { return available() ? _rx[_next].c : -1; }
+    size_t write(uint8_t c) { (void) c; _written++; return 1; }
+    using Print::write;
+    unsigned long written() const { return _written; }
+private:
+    struct Byte {
+        unsigned long long due;
+        uint8_t c;
+    };
+    std::vector<Byte> _rx;
+    size_t _next;
+    size_t _ready; //bytes up to here are due
+    unsigned long _written;
+};
+
+static ReplayUart REPLAY_UART;
+Uart& Serial1 = REPLAY_UART;
+
+//the application: takes every URC line, GPS output goes through the NMEA parser
+class ReplayUrcSink : public ModemUrcHandler {
+public:
+    ReplayUrcSink() : lines(0), bytes(0) {}
+    void handleUrc(const void* data, uint16_t len)
+    {
+        lines++;
+        bytes += len;
+        const char* line = static_cast<const char*>(data);
+        const char* sentence = static_cast<const char*>(memchr(line, '$', len));
+        if (sentence != NULL){
+            nmea.feed(sentence, len - (sentence - line));
+            nmea.feed('\n');
+        }
+    }
+    unsigned long lines;
+    unsigned long bytes;
+    NMEAParser nmea;
+};
+
+class ModemReplay {
+public:
+    ModemReplay() : _polls(0), _socketBytes(0), _nanos(0), _cycles(0) {}
+
+    void begin(ReplayUrcSink* sink)
+    {
+        for (uint8_t mux = 0; mux < MAX_SOCKETS; mux++){
+            if (MODEM._sockets[mux] == NULL){
+                MODEM._sockets[mux] = GSM_Socket::acquire(mux);
+            }
+        }
+        MODEM.addUrcHandler(sink);
+    }
+
+    void run(const std::vector<ReplayRecord>& records)
+    {
+        unsigned long long start = ArduinoNative::now();
+        unsigned long first = records.empty() ? 0 : records[0].ms;
+        for (size_t i = 0; i < records.size(); i++){
+            if (!records[i].tx){
+                REPLAY_UART.schedule(start + 1000ULL * (records[i].ms - first), records[i].bytes);
+            }
+        }
+        for (size_t i = 0; i < records.size();){
+            unsigned long long due = start + 1000ULL * (records[i].ms - first);
+            if (ArduinoNative::now() < due){
+                delayMicroseconds(due - ArduinoNative::now());
+            }
+            if (!records[i].tx){
+                pollAll();
+                i++;
+                continue;
+            }
+            //consecutive TX records are one write sequence of the driver
+            std::string tx;
+            for (; i < records.size() && records[i].tx; i++){
+                tx += records[i].bytes;
+            }
+            transmit(tx);
+        }
+        pollAll();
+    }
+
+    void report(const ReplayUrcSink& sink, unsigned long rxBytes, unsigned long repeat) const
+    {
+        unsigned long total = rxBytes * repeat;
+        double seconds = _nanos / 1e9;
+        printf("replayed   %lu RX bytes x %lu, %lu poll() calls, %lu TX bytes reissued\n", rxBytes, repeat, _polls,
+            REPLAY_UART.written());
+        printf("delivered  %lu socket bytes, %lu URC lines (%lu bytes), %lu NMEA sentences\n", _socketBytes,
+            sink.lines, sink.bytes, (unsigned long) sink.nmea.sentences());
+        printf("parser     %.1f MB/s   %.1f ns/byte   %.1f cycles/byte   %lu allocations (%.3f/byte)\n",
+            seconds > 0 ? total / seconds / 1e6 : 0.0, total ? _nanos / (double) total : 0.0,
+            total ? _cycles / (double) total : 0.0, allocations, total ? allocations / (double) total : 0.0);
+    }
+
+private:
+    static unsigned long long threadNanos()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    //poll until every byte due by now is parsed, the application consuming what it delivers
+    void pollAll()
+    {
+        while (REPLAY_UART.available() > 0){
+            unsigned long long nanos = threadNanos();
+            unsigned long long cycles = REPLAY_CYCLES();
+            countAllocations = true;
+            MODEM.poll();
+            countAllocations = false;
+            _cycles += REPLAY_CYCLES() - cycles;
+            _nanos += threadNanos() - nanos;
+            _polls++;
+            for (uint8_t mux = 0; mux < MAX_SOCKETS; mux++){
+                GSM_Socket* socket = MODEM._sockets[mux];
+                _socketBytes += socket->available();
+                socket->consume(socket->available());
+            }
+        }
+    }
+
+    void transmit(const std::string& tx)
+    {
+        size_t pos = 0;
+        while (pos < tx.size()){
+            size_t end = tx.find("\r\n", pos);
+            if (tx.compare(pos, 2, "AT") == 0 && end != std::string::npos){
+                std::string line = tx.substr(pos, end - pos);
+                MODEM.send(line.c_str());
+                //the echo setting is tracked by turnEcho(), which is not the one issuing it here
+                if (line == "ATE0") MODEM._echo = false;
+                else if (line == "ATE1") MODEM._echo = true;
+                pos = end + 2;
+            }
+            else{
+                size_t len = end == std::string::npos ? tx.size() - pos : end + 2 - pos;
+                MODEM.write(reinterpret_cast<const uint8_t*>(tx.data() + pos), len);
+                pos += len;
+            }
+        }
+    }
+
+    unsigned long _polls;
+    unsigned long _socketBytes;
+    unsigned long long _nanos;
+    unsigned long long _cycles;
+};
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+//"R|T <ms> <hex>" lines, '#' comments
+static bool load(const char* path, std::vector<ReplayRecord>* records)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return false;
+    char line[512];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL){
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+        char* p = line + 1;
+        ReplayRecord record;
+        record.tx = line[0] == 'T';
+        record.ms = strtoul(p, &p, 10);
+        ok = (line[0] == 'R' || line[0] == 'T') && *p++ == ' ';
+        while (ok && hexValue(p[0]) >= 0 && hexValue(p[1]) >= 0){
+            record.bytes += static_cast<char>(hexValue(p[0]) << 4 | hexValue(p[1]));
+            p += 2;
+        }
+        records->push_back(record);
+    }
+    fclose(file);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2){
+        fprintf(stderr, "usage: %s <transcript> [--repeat n]\n", argv[0]);
+        return 2;
+    }
+    unsigned long repeat = 1;
+    for (int i = 2; i + 1 < argc; i += 2){
+        if (!strcmp(argv[i], "--repeat")) repeat = max(1UL, strtoul(argv[i + 1], NULL, 10));
+    }
+
+    std::vector<ReplayRecord> records;
+    if (!load(argv[1], &records)){
+        fprintf(stderr, "%s: not a capture transcript\n", argv[1]);
+        return 1;
+    }
+    unsigned long rxBytes = 0;
+    unsigned long txBytes = 0;
+    for (size_t i = 0; i < records.size(); i++){
+        (records[i].tx ? txBytes : rxBytes) += records[i].bytes.size();
+    }
+    printf("transcript %zu records, %lu RX bytes, %lu TX bytes, %lu ms\n", records.size(), rxBytes, txBytes,
+        records.empty() ? 0 : records.back().ms - records.front().ms);
+
+    ReplayUrcSink sink;
+    ModemReplay replay;
+    replay.begin(&sink);
+    for (unsigned long r = 0; r < repeat; r++){
+        replay.run(records);
+    }
+    replay.report(sink, rxBytes, repeat);
+#ifndef MODEM_NO_STATS
+    MODEM.stats().dump(SerialUSB);
+#endif
+    return 0;
+}
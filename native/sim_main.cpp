@@ -0,0 +1,450 @@
+/*Host driver for the A9G simulator: runs the GSM -> GPRS -> socket round trip scenario
+    against the simulated modem and reports virtual (modem) time and host CPU time per phase.
+
+    usage: program [--latency ms] [--jitter ms] [--loss rate] [--seed n] [--rounds n] [--size bytes]
+                   [--stable-baud rate] [--sync-connect] [--capture file]
+
+    --capture records the UART traffic of the whole session and writes its transcript to file,
+    for the replay benchmark (replay_main.cpp).
+*/
+
+#include <A9GLib.h>
+#include <set>
+#include <time.h>
+
+#include "A9GSimulator.h"
+#include "FileFlash.h"
+#include "FixBatcher.h"
+#include "GSMClock.h"
+#include "GSMLocation.h"
+#include "MemoryStats.h"
+#include "PositionCodec.h"
+
+static void onSignal(int result, const ModemResponse& response, void* context)
+{
+    long rssi;
+    *static_cast<int*>(context) = result == 1 && response.intAfter("+CSQ:", &rssi) ? rssi : -1;
+}
+
+static double cpuSeconds()
+{
+    return static_cast<double>(clock()) / CLOCKS_PER_SEC;
+}
+
+class FilePrint : public Print {
+public:
+    explicit FilePrint(FILE* file) : _file(file) {}
+    size_t write(uint8_t c) { return fputc(c, _file) == EOF ? 0 : 1; }
+    using Print::write;
+private:
+    FILE* _file;
+};
+
+static ModemCaptureBuffer<65535> capture;
+
+class Phase {
+public:
+    explicit Phase(const char* name) : _name(name), _virtualStart(ArduinoNative::now()), _cpuStart(cpuSeconds()) {}
+    void end(bool ok)
+    {
+        printf("%-10s %-4s modem %9.1f ms   host %8.3f ms\n", _name, ok ? "ok" : "FAIL",
+            (ArduinoNative::now() - _virtualStart) / 1000.0, (cpuSeconds() - _cpuStart) * 1000.0);
+    }
+private:
+    const char* _name;
+    unsigned long long _virtualStart;
+    double _cpuStart;
+};
+
+int main(int argc, char** argv)
+{
+    MEMORY_STATS.paintStack();
+    A9GSimConfig config = A9G_SIM.config();
+    unsigned long rounds = 10;
+    uint16_t size = 64;
+    const char* capturePath = NULL;
+
+    for (int i = 1; i < argc; i++){
+        if (!strcmp(argv[i], "--sync-connect")){
+            config.asyncConnect = false;
+            continue;
+        }
+        if (i + 1 == argc) break;
+        const char* value = argv[i + 1];
+        if (!strcmp(argv[i], "--latency")) config.latencyMs = strtoul(value, NULL, 10);
+        else if (!strcmp(argv[i], "--jitter")) config.jitterMs = strtoul(value, NULL, 10);
+        else if (!strcmp(argv[i], "--loss")) config.lossRate = strtof(value, NULL);
+        else if (!strcmp(argv[i], "--seed")) config.seed = strtoul(value, NULL, 10);
+        else if (!strcmp(argv[i], "--rounds")) rounds = strtoul(value, NULL, 10);
+        else if (!strcmp(argv[i], "--size")) size = strtoul(value, NULL, 10);
+        else if (!strcmp(argv[i], "--stable-baud")) config.stableBaud = strtoul(value, NULL, 10);
+        else if (!strcmp(argv[i], "--capture")) capturePath = value;
+        i++;
+    }
+    A9G_SIM.configure(config);
+    if (capturePath != NULL){
+        MODEM.setCapture(&capture);
+    }
+
+    GSM gsm;
+    GPRS gprs;
+    gsm.setTimeout(30000);
+    gprs.setTimeout(30000);
+
+    Phase init("init");
+    bool ok = gsm.init() == GSM_READY;
+    init.end(ok);
+    if (!ok) return 1;
+
+    //fastest rate with a clean echo burst, kept across reboots; started with echo off, as in a socket session
+    Phase baud("baud");
+    unsigned long rate = MODEM.turnEcho(false) ? MODEM.negotiateBaudRate() : 0;
+    ok = rate != 0 && rate == A9G_SIM.baud() && rate == A9G_SIM.savedBaud() && !A9G_SIM.echo() && A9G_SIM.savedEcho();
+    baud.end(ok);
+    printf("           %lu baud (stable up to %lu)\n", rate, config.stableBaud);
+    if (!ok) return 1;
+
+    //the modem boots from its profile: init() finds it at the negotiated rate, echo on, and stays there
+    Phase reboot("reboot");
+    ok = MODEM.powerOff();
+    A9G_SIM.powerCycle();
+    ok = ok && gsm.init() == GSM_READY && MODEM.baudRate() == rate && A9G_SIM.baud() == rate && A9G_SIM.echo();
+    reboot.end(ok);
+    if (!ok) return 1;
+
+    //queued commands complete from poll() while the main loop keeps running
+    Phase async("async");
+    int rssi = 0;
+    ModemFuture registration;
+    MODEM.enqueue("AT+CSQ", 1000, onSignal, &rssi);
+    MODEM.enqueue("AT+CREG?", 1000, &registration);
+    unsigned long iterations = 0;
+    while (rssi == 0 || !registration.done()){
+        MODEM.poll();
+        iterations++;
+    }
+    async.end(rssi > 0 && registration.result == 1);
+    printf("           rssi %d, \"%.*s\", %lu loop iterations while pending\n", rssi, registration.response.length(),
+        registration.response.data(), iterations);
+
+    unsigned long commands;
+    //one AT+CCLK? then timestamps from millis(), resynced in the background on a network time report
+    Phase wallClock("clock");
+    bool timed;
+    unsigned long nowCalls = 0;
+    double nowNanos = 0;
+    {
+        GSMClock clock;
+        commands = A9G_SIM.commands();
+        //the modem reports whole seconds: the clock lags by less than one
+        timed = clock.sync() && A9G_SIM.clock() - clock.now() <= 1 && clock.localNow() - clock.now() == 4 * 900;
+        double cpuStart = cpuSeconds();
+        uint32_t last = 0;
+        for (unsigned long start = millis(); millis() - start < 5000; nowCalls++){
+            last = clock.now();
+            delayMicroseconds(50);
+        }
+        nowNanos = (cpuSeconds() - cpuStart) * 1e9 / nowCalls;
+        timed = timed && A9G_SIM.commands() - commands == 1 && A9G_SIM.clock() - last <= 1;
+        //the network moves the clock: picked up from poll(), without a blocking query
+        A9G_SIM.setClock(A9G_SIM.clock() + 3600, 8);
+        A9G_SIM.injectUrc("+CTZV: +08");
+        for (unsigned long start = millis(); clock.zone() != 8 && millis() - start < 1000;){
+            clock.now();
+            MODEM.poll();
+        }
+        timed = timed && clock.zone() == 8 && A9G_SIM.clock() - clock.now() <= 1 && A9G_SIM.commands() - commands == 2;
+    }
+    ok = timed;
+    wallClock.end(timed);
+    printf("           %lu timestamps in 5 s from 1 query, %.0f ns host time per timestamp\n", nowCalls, nowNanos);
+    if (!ok) return 1;
+
+    //coverage lost and found again: followed from the +CREG reports, no AT+CREG? polling
+    Phase network("network");
+    commands = A9G_SIM.commands();
+    A9G_SIM.setRegistration(2);
+    A9G_SIM.setRegistration(1, 3000);
+    delay(50);
+    bool lost = !gsm.isAccessAlive() && gsm.status() == CONNECTING;
+    unsigned long networkStart = millis();
+    bool found = gsm.waitForNetwork(10000);
+    unsigned long networkMs = millis() - networkStart;
+    unsigned long networkCommands = A9G_SIM.commands() - commands;
+    found = lost && found && gsm.status() == GSM_READY && gsm.locationAreaCode() == 0x5A2B && gsm.cellId() == 0x0C3D &&
+        networkCommands == 0;
+    ok = found;
+    network.end(found);
+    printf("           registered again after %lu ms, %lu commands, cell %04X/%04lX\n", networkMs, networkCommands,
+        gsm.locationAreaCode(), (unsigned long) gsm.cellId());
+    if (!ok) return 1;
+
+    Phase attach("attach");
+    commands = A9G_SIM.commands();
+    ok = gprs.attachGPRS("internet", NULL, NULL) == GPRS_READY; //no credentials, sent as ""
+    attach.end(ok);
+    printf("           time to IP %lu ms, %lu commands\n", gprs.timeToIP(), A9G_SIM.commands() - commands);
+    if (!ok) return 1;
+
+    Phase connect("connect");
+    uint8_t mux = 0;
+    GPRS::ConnectionStatus status;
+    ok = gprs.connect("10.0.0.1", 8080, &mux, 60, &status);
+    connect.end(ok);
+    if (!ok) return 1;
+
+    uint8_t out[1024];
+    uint8_t in[1024];
+    size = min(size, (uint16_t) sizeof(out));
+    for (uint16_t i = 0; i < size; i++) out[i] = 'a' + i % 26;
+
+    Phase echo("echo");
+    unsigned long failed = 0;
+    for (unsigned long r = 0; r < rounds; r++){
+        if (gprs.send(mux, out, size) != size){
+            failed++;
+            continue;
+        }
+        int got = gprs.read(mux, in, size, 5000);
+        if (got != size || memcmp(in, out, size) != 0) failed++;
+    }
+    echo.end(failed == 0);
+    printf("           %lu rounds of %u bytes, %lu failed\n", rounds, size, failed);
+
+    //pipelined uplink burst: packets are written back to back, echoes read at the end
+    //(as many as the receive buffer can hold)
+    Phase burst("burst");
+    unsigned long burstFailed = 0;
+    unsigned long packets = min(rounds, max(1UL, (unsigned long) GSM_SOCKET0_BUFFER_SIZE / size));
+    for (unsigned long r = 0; r < packets; r++){
+        if (gprs.send(mux, out, size, false) != size) burstFailed++;
+    }
+    for (unsigned long r = 0; r < packets; r++){
+        if (gprs.read(mux, in, size, 5000) != size || memcmp(in, out, size) != 0) burstFailed++;
+    }
+    burstFailed += gprs.failedSends(mux);
+    //a pipelined packet the modem rejects: send() has already returned, failedSends() reports it,
+    //also when data from the peer arrives between the ERROR and the next command
+    A9G_SIM.failSends(1);
+    bool rejectedSeen = gprs.send(mux, out, size, false) == size;
+    A9G_SIM.pushData(mux & GSM_SOCKET_MUX_MASK, out, size);
+    for (unsigned long start = millis(); millis() - start < 2000;){
+        MODEM.poll();
+    }
+    rejectedSeen = rejectedSeen && gprs.failedSends(mux) == 1 && gprs.read(mux, in, size, 5000) == size;
+    burst.end(burstFailed == 0 && rejectedSeen);
+    failed += burstFailed + !rejectedSeen;
+
+    Phase close("close");
+    ok = gprs.close(mux, 1000);
+    close.end(ok);
+
+    //request/response with a server closing the connection: the end is seen right away, not after the timeout
+    Phase http("http");
+    A9G_SIM.setCloseAfterReply(true);
+    uint8_t httpMux = 0;
+    unsigned long httpStart = millis();
+    bool answered = gprs.connect("10.0.0.1", 80, &httpMux, 60, &status);
+    const char request[] = "GET / HTTP/1.0\r\n\r\n";
+    answered = answered && gprs.send(httpMux, request, sizeof(request) - 1) == sizeof(request) - 1;
+    int response = 0;
+    for (int got = 0; answered && (got = gprs.read(httpMux, in, sizeof(in), 5000)) >= 0;){
+        response += got;
+    }
+    unsigned long httpMs = millis() - httpStart;
+    //the mux was freed at the end of the connection: closing it sends nothing
+    commands = A9G_SIM.commands();
+    answered = answered && response == (int) sizeof(request) - 1 && gprs.socketState(httpMux) == GSM_SOCKET_CLOSED &&
+        gprs.close(httpMux, 1000) && A9G_SIM.commands() == commands && httpMs < 5000;
+    A9G_SIM.setCloseAfterReply(false);
+    ok = ok && answered;
+    http.end(answered);
+    printf("           %d response bytes then end of connection in %lu ms (read timeout 5000 ms)\n", response, httpMs);
+
+    //duty cycle wake-up: the bearer is still up, only its state is queried
+    Phase reattach("reattach");
+    commands = A9G_SIM.commands();
+    bool reattached = gprs.attachGPRS("internet", "", "") == GPRS_READY && A9G_SIM.bearerUp();
+    unsigned long reattachCommands = A9G_SIM.commands() - commands;
+    reattached = reattached && reattachCommands == 1;
+    ok = ok && reattached;
+    reattach.end(reattached);
+    printf("           time to IP %lu ms, %lu commands\n", gprs.timeToIP(), reattachCommands);
+
+    //primary and backup server connected at once: takes the slower connect, not the sum of both
+    Phase failover("failover");
+    uint8_t primary = 0;
+    uint8_t backup = 0;
+    unsigned long failoverStart = millis();
+    bool connected = gprs.connectAsync("10.0.0.1", 8080, &primary, 60) && gprs.connectAsync("10.0.0.2", 8080, &backup, 60);
+    GPRS::ConnectionStatus primaryStatus = GPRS::ConnectionStatus::ERROR;
+    GPRS::ConnectionStatus backupStatus = GPRS::ConnectionStatus::ERROR;
+    while (connected){
+        primaryStatus = gprs.connectStatus(primary);
+        backupStatus = gprs.connectStatus(backup);
+        if (primaryStatus != GPRS::ConnectionStatus::PENDING && backupStatus != GPRS::ConnectionStatus::PENDING) break;
+    }
+    unsigned long failoverMs = millis() - failoverStart;
+    connected = connected && primaryStatus == GPRS::ConnectionStatus::CONNECT_OK && backupStatus == GPRS::ConnectionStatus::CONNECT_OK
+        && primary != backup;
+    //the handle of the http connection is stale, though the modem has given its mux out again
+    commands = A9G_SIM.commands();
+    bool staleRejected = gprs.send(httpMux, out, 1) == 0 && gprs.socketState(httpMux) == GSM_SOCKET_CLOSED &&
+        A9G_SIM.commands() == commands;
+    connected = connected && staleRejected;
+    //nothing was sent on either socket: echo is still on, closing takes one AT+CIPCLOSE each
+    commands = A9G_SIM.commands();
+    connected = connected && gprs.close(primary, 1000) && gprs.close(backup, 1000) && A9G_SIM.commands() - commands == 2;
+    ok = ok && connected;
+    failover.end(connected);
+    printf("           2 sockets open in %lu ms (connect takes %lu ms), stale handle %02x %s\n", failoverMs, config.connectMs,
+        httpMux, staleRejected ? "rejected" : "accepted");
+
+    //store-and-forward: 8 fixes leave in a single connection
+    Phase batch("batch");
+    A9G_SIM.setRemoteEcho(false);
+    size_t before = A9G_SIM.received().size();
+    FixBatcher batcher(gsm, gprs);
+    batcher.begin("10.0.0.1", 9000, 8);
+    bool flushed = false;
+    for (int i = 0; i < 8; i++){
+        batcher.add(45.4064f + i * 1e-4f, 11.8768f - i * 1e-4f, 12 + i, 5, 1644261501UL + i * 10);
+        flushed |= batcher.poll();
+    }
+    //decode on the "server" side
+    const std::string& received = A9G_SIM.received();
+    PositionDecoder decoder(reinterpret_cast<const uint8_t*>(received.data()) + before, received.size() - before);
+    PositionFix fix;
+    int decoded = 0;
+    while (decoder.next(&fix)){
+        if (fix.timestamp == 1644261501UL + decoded * 10 && fix.altitude == 12 + decoded) decoded++;
+    }
+    flushed = flushed && batcher.pending() == 0 && decoded == 8 && !decoder.error();
+    ok = ok && flushed;
+    batch.end(flushed);
+    printf("           %u payload bytes received by the server, %d fixes decoded\n", (unsigned) (received.size() - before), decoded);
+
+    //same reports as acknowledged UDP datagrams: no handshake, lost datagrams and acks retransmitted
+    Phase udp("udp");
+    const int udpBatches = 4;
+    size_t datagramsBefore = A9G_SIM.datagrams().size();
+    A9GSimConfig lossy = config;
+    lossy.datagramLoss = 0.2f;
+    A9G_SIM.configure(lossy);
+    FixBatcher udpBatcher(gsm, gprs);
+    udpBatcher.setProtocol(GPRS::Protocol::UDP);
+    udpBatcher.begin("10.0.0.1", 9000, 8);
+    for (int i = 0; i < udpBatches * 8; i++){
+        udpBatcher.add(45.4064f + i * 1e-4f, 11.8768f, 12, 5, 1644263000UL + i * 10);
+        udpBatcher.poll();
+    }
+    udpBatcher.flush();
+    A9G_SIM.configure(config);
+    //the server keeps the first copy of each sequence number
+    const std::vector<std::string>& datagrams = A9G_SIM.datagrams();
+    std::set<uint16_t> sequences;
+    int udpDecoded = 0;
+    int duplicates = 0;
+    for (size_t i = datagramsBefore; i < datagrams.size(); i++){
+        const uint8_t* frame = reinterpret_cast<const uint8_t*>(datagrams[i].data());
+        if (datagrams[i].size() < DATAGRAM_HEADER_SIZE || frame[0] != DATAGRAM_MAGIC || frame[1] != DATAGRAM_DATA) continue;
+        if (!sequences.insert(frame[2] << 8 | frame[3]).second){
+            duplicates++;
+            continue;
+        }
+        PositionDecoder payload(frame + DATAGRAM_HEADER_SIZE, datagrams[i].size() - DATAGRAM_HEADER_SIZE);
+        while (payload.next(&fix)){
+            if (fix.timestamp == 1644263000UL + udpDecoded * 10) udpDecoded++;
+        }
+    }
+    bool delivered = udpBatcher.pending() == 0 && udpDecoded == udpBatches * 8;
+    ok = ok && delivered;
+    udp.end(delivered);
+    printf("           %d fixes in %u datagrams (%lu retransmits, %d duplicates dropped) with %.0f%% datagram loss\n",
+        udpDecoded, (unsigned) sequences.size(), (unsigned long) udpBatcher.link().retransmits(), duplicates,
+        lossy.datagramLoss * 100);
+
+    //no coverage: fixes go to the flash log, survive a reset and are drained once the server is reachable
+    Phase offline("offline");
+    const char* flashPath = "a9g_sim_flash.bin";
+    remove(flashPath);
+    const int offlineFixes = 64;
+    unsigned long stored = 0;
+    before = A9G_SIM.received().size();
+    {
+        FileFlash flash(flashPath, 4 * 1024);
+        FlashLog log(flash);
+        FixBatcher offlineBatcher(gsm, gprs);
+        log.begin();
+        offlineBatcher.begin("10.0.0.1", 9000, 8);
+        offlineBatcher.setLog(&log);
+        A9G_SIM.refuseConnections(true);
+        for (int i = 0; i < offlineFixes; i++){
+            offlineBatcher.add(45.4064f + i * 1e-4f, 11.8768f, 12, 5, 1644262000UL + i * 10);
+            offlineBatcher.poll();
+        }
+        offlineBatcher.flush();
+        stored = log.records();
+        A9G_SIM.refuseConnections(false);
+    }
+    FileFlash flash(flashPath, 4 * 1024);
+    FlashLog log(flash);
+    bool drained = log.begin() && !log.empty();
+    FixBatcher drainBatcher(gsm, gprs);
+    drainBatcher.begin("10.0.0.1", 9000, 8);
+    drainBatcher.setLog(&log);
+    drained = drained && drainBatcher.flush() && !drainBatcher.stored();
+    const std::string& uplink = A9G_SIM.received();
+    int recovered = 0;
+    int payloads = 0;
+    for (size_t offset = before; offset < uplink.size(); payloads++){
+        PositionDecoder payload(reinterpret_cast<const uint8_t*>(uplink.data()) + offset, uplink.size() - offset);
+        while (payload.next(&fix)){
+            if (fix.timestamp == 1644262000UL + recovered * 10) recovered++;
+        }
+        if (payload.error() || payload.consumed() == 0) break;
+        offset += payload.consumed();
+    }
+    drained = drained && recovered == offlineFixes;
+    ok = ok && drained;
+    offline.end(drained);
+    printf("           %lu records in flash across the reset, %d/%d fixes recovered in %d payloads\n", stored, recovered,
+        offlineFixes, payloads);
+    remove(flashPath);
+
+    //NMEA reports every second, parsed as they stream in
+    Phase gps("gps");
+    GSMLocation location;
+    bool located = location.set(true, 1);
+    int positions = 0;
+    unsigned long gpsStart = millis();
+    while (located && positions < 5 && millis() - gpsStart < 10000){
+        if (location.available()) positions++;
+    }
+    PositionFix last;
+    location.fix(&last);
+    located = located && positions == 5 && last.timestamp == 1644261505UL && location.set(false);
+    ok = ok && located;
+    gps.end(located);
+    printf("           %d positions, last %.6f %.6f %ld m +-%ld m\n", positions, location.latitude(), location.longitude(),
+        location.altitude(), location.accuracy());
+
+    printf("modem commands: %lu\n", A9G_SIM.commands());
+    FILE* transcript = capturePath != NULL ? fopen(capturePath, "w") : NULL;
+    if (transcript != NULL){
+        FilePrint out(transcript);
+        capture.dump(out);
+        fclose(transcript);
+        printf("capture: %u bytes in the ring, %lu bytes of traffic lost\n", capture.used(), (unsigned long) capture.lost());
+    }
+#ifndef MODEM_NO_STATS
+    MODEM.stats().dump(SerialUSB);
+    uint8_t snapshot[256];
+    printf("stats snapshot: %u bytes\n", MODEM.stats().serialize(snapshot, sizeof(snapshot)));
+#endif
+    MEMORY_STATS.addStatic("capture", sizeof(capture));
+    MEMORY_STATS.dump(SerialUSB);
+    uint8_t memory[64];
+    printf("memory snapshot: %u bytes\n", MEMORY_STATS.serialize(memory, sizeof(memory)));
+    return failed == 0 && ok ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#include "DatagramLink.h"
+
+DatagramLink::DatagramLink(GPRS& gprs):
+    _gprs(gprs),
+    _sequence(0),
+    _retransmits(0),
+    _rxLen(0)
+{
+}
+
+bool DatagramLink::send(uint8_t mux, uint8_t* frame, uint16_t len)
+{
+    uint16_t sequence = _sequence++;
+    frame[0] = DATAGRAM_MAGIC;
+    frame[1] = DATAGRAM_DATA;
+    frame[2] = sequence >> 8;
+    frame[3] = sequence & 0xFF;
+    len += DATAGRAM_HEADER_SIZE;
+
+    unsigned long timeout = DATAGRAM_ACK_TIMEOUT_MS;
+    for (uint8_t attempt = 0; attempt <= DATAGRAM_RETRIES; attempt++){
+        if (attempt > 0){
+            DBG("#DEBUG# no ack for datagram ", sequence, ", retransmitting");
+            _retransmits++;
+            timeout *= 2;
+        }
+        if (_gprs.send(mux, frame, len) != len) continue;
+        if (waitAck(mux, sequence, timeout)) return true;
+    }
+    return false;
+}
+
+bool DatagramLink::waitAck(uint8_t mux, uint16_t sequence, unsigned long timeout)
+{
+    unsigned long start = millis();
+    for (unsigned long elapsed = 0; elapsed < timeout; elapsed = millis() - start){
+        uint8_t c;
+        if (_gprs.read(mux, &c, 1, timeout - elapsed) <= 0) break;
+        if (_rxLen == 0 && c != DATAGRAM_MAGIC) continue; //not at a frame start
+        _rx[_rxLen++] = c;
+        if (_rxLen < DATAGRAM_HEADER_SIZE) continue;
+        _rxLen = 0;
+        //acks of earlier copies of a datagram already acked are ignored
+        if (_rx[1] == DATAGRAM_ACK && (_rx[2] << 8 | _rx[3]) == sequence) return true;
+    }
+    return false;
+}
@@ -0,0 +1,179 @@
+#include "FixBatcher.h"
+#include "PositionCodec.h"
+
+#define FIX_BATCH_PAYLOAD_MAX (POSITION_CODEC_HEADER_SIZE + FIX_BATCH_SIZE * POSITION_CODEC_RECORD_MAX)
+
+FixBatcher::FixBatcher(GSM& gsm, GPRS& gprs):
+    _gsm(gsm),
+    _gprs(gprs),
+    _log(NULL),
+    _protocol(GPRS::Protocol::TCP),
+    _link(gprs),
+    _host(NULL),
+    _port(0),
+    _maxFixes(FIX_BATCH_SIZE),
+    _maxAgeMs(0),
+    _head(0),
+    _count(0),
+    _oldestMillis(0),
+    _retryMillis(0),
+    _retry(false)
+{
+}
+
+void FixBatcher::begin(const char* host, uint16_t port, uint8_t maxFixes, unsigned long maxAgeMs)
+{
+    _host = host;
+    _port = port;
+    _maxFixes = min(max(maxFixes, (uint8_t) 1), (uint8_t) FIX_BATCH_SIZE);
+    _maxAgeMs = maxAgeMs;
+    _gsm.lowPowerMode();
+}
+
+bool FixBatcher::add(const PositionFix& fix)
+{
+    bool dropped = false;
+    //a failed flush leaves room when the fixes went to the flash log
+    if (_count == FIX_BATCH_SIZE && !flush() && _count == FIX_BATCH_SIZE){
+        DBG("#DEBUG# fix batch full, dropping oldest fix");
+        _head = (_head + 1) % FIX_BATCH_SIZE;
+        _count--;
+        dropped = true;
+    }
+    if (_count == 0){
+        _oldestMillis = millis();
+    }
+    _fixes[(_head + _count) % FIX_BATCH_SIZE] = fix;
+    _count++;
+    return !dropped;
+}
+
+bool FixBatcher::add(float latitude, float longitude, long altitude, long accuracy, unsigned long timestamp)
+{
+    PositionFix fix;
+    fix.latitude = lroundf(latitude * 1e6f);
+    fix.longitude = lroundf(longitude * 1e6f);
+    fix.altitude = altitude;
+    fix.accuracy = min(max(accuracy, 0L), 0xFFFFL);
+    fix.timestamp = timestamp;
+    return add(fix);
+}
+
+bool FixBatcher::poll()
+{
+    if (_count == 0 && !stored()) return false;
+    if (_retry && (long) (millis() - _retryMillis) < 0) return false;
+    if (_count >= _maxFixes || millis() - _oldestMillis >= _maxAgeMs || stored()){
+        return flush();
+    }
+    return false;
+}
+
+bool FixBatcher::flush()
+{
+    if (_count == 0 && !stored()) return true;
+
+    //headroom for the datagram header
+    uint8_t frame[DATAGRAM_HEADER_SIZE + FIX_BATCH_PAYLOAD_MAX];
+    uint8_t* payload = frame + DATAGRAM_HEADER_SIZE;
+    uint8_t encoded = 0;
+    bool sent = false;
+    uint8_t mux;
+    GPRS::ConnectionStatus status;
+    if (_gprs.connect(_host, _port, &mux, FIX_BATCH_CONNECT_TIMEOUT_S, &status, _protocol) &&
+        status == GPRS::ConnectionStatus::CONNECT_OK){
+        //stored fixes are older: they go first
+        sent = drain(mux, payload, FIX_BATCH_PAYLOAD_MAX);
+        if (sent && _count > 0){
+            uint16_t len = encode(payload, FIX_BATCH_PAYLOAD_MAX, &encoded);
+            sent = sendPayload(mux, payload, len);
+        }
+        _gprs.close(mux, 1000);
+    }
+    _gsm.lowPowerMode(); //radio stays idle until the next batch
+
+    if (!sent){
+        DBG("#DEBUG# fix batch flush failed, ", _count, " fixes kept");
+        if (_log != NULL && !spill()){
+            DBG("#DEBUG# fix batch could not be stored in flash");
+        }
+        _retry = true;
+        _retryMillis = millis() + FIX_BATCH_RETRY_MS;
+        return false;
+    }
+    _retry = false;
+    _head = (_head + encoded) % FIX_BATCH_SIZE;
+    _count -= encoded;
+    if (_count > 0){
+        _oldestMillis = millis();
+    }
+    return true;
+}
+
+//sends the flash log in full payloads, each one trimmed from the log once sent
+bool FixBatcher::drain(uint8_t mux, uint8_t* payload, uint16_t size)
+{
+    if (!stored()) return true;
+
+    _log->rewind();
+    uint8_t record[FLASH_LOG_PAYLOAD_MAX];
+    for (;;){
+        PositionEncoder encoder(payload, size);
+        //whole records only: a record is never split between two payloads
+        while (encoder.length() + FIX_BATCH_LOG_FIXES * POSITION_CODEC_RECORD_MAX <= size){
+            int len = _log->read(record, sizeof(record));
+            if (len < 0) break;
+            PositionDecoder decoder(record, len);
+            PositionFix fix;
+            while (decoder.next(&fix)){
+                encoder.add(fix);
+            }
+        }
+        if (encoder.count() == 0){
+            return _log->trim();
+        }
+        if (!sendPayload(mux, payload, encoder.length())){
+            _log->rewind();
+            return false;
+        }
+        _log->trim();
+    }
+}
+
+//payload is preceded by DATAGRAM_HEADER_SIZE bytes of headroom
+bool FixBatcher::sendPayload(uint8_t mux, uint8_t* payload, uint16_t len)
+{
+    if (_protocol == GPRS::Protocol::UDP){
+        return _link.send(mux, payload - DATAGRAM_HEADER_SIZE, len);
+    }
+    return _gprs.send(mux, payload, len) == len;
+}
+
+//moves the RAM queue to the flash log
+bool FixBatcher::spill()
+{
+    while (_count > 0){
+        uint8_t record[FLASH_LOG_PAYLOAD_MAX];
+        PositionEncoder encoder(record, min((uint16_t) _log->payloadMax(), (uint16_t) sizeof(record)));
+        for (uint8_t i = 0; i < _count && i < FIX_BATCH_LOG_FIXES; i++){
+            if (!encoder.add(_fixes[(_head + i) % FIX_BATCH_SIZE])) break;
+        }
+        if (encoder.count() == 0 || !_log->append(record, encoder.length())){
+            return false;
+        }
+        _head = (_head + encoder.count()) % FIX_BATCH_SIZE;
+        _count -= encoder.count();
+    }
+    return true;
+}
+
+//delta/varint encodes as many queued fixes as fit in size bytes
+uint16_t FixBatcher::encode(uint8_t* out, uint16_t size, uint8_t* encoded) const
+{
+    PositionEncoder encoder(out, min(size, (uint16_t) FIX_BATCH_PAYLOAD_MAX));
+    for (uint8_t i = 0; i < _count; i++){
+        if (!encoder.add(_fixes[(_head + i) % FIX_BATCH_SIZE])) break;
+    }
+    *encoded = encoder.count();
+    return encoder.length();
+}
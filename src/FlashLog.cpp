@@ -0,0 +1,284 @@
+#include "FlashLog.h"
+
+#include <string.h>
+
+#include "Crc16.h"
+
+#define FLASH_LOG_DATA 0x01
+#define FLASH_LOG_TRIM 0x02
+
+FlashLog::FlashLog(FlashDevice& flash):
+    _flash(flash),
+    _pageSize(0),
+    _rowSize(0),
+    _size(0),
+    _headAddr(0),
+    _headSeq(0),
+    _tailAddr(0),
+    _tailSeq(0),
+    _readAddr(0),
+    _readSeq(0),
+    _dropped(0)
+{
+}
+
+bool FlashLog::begin()
+{
+    _pageSize = _flash.pageSize();
+    _rowSize = _flash.rowSize();
+    _size = _flash.size();
+    _dropped = 0;
+    if (_pageSize > FLASH_LOG_PAGE_MAX || _pageSize <= FLASH_LOG_HEADER_SIZE || _size < 2UL * _rowSize){
+        return false;
+    }
+
+    //newest row: the one whose first record has the highest sequence number
+    Header newest;
+    memset(&newest, 0, sizeof(newest));
+    uint32_t headRow = 0;
+    bool found = false;
+    for (uint32_t row = 0; row < _size; row += _rowSize){
+        Header h;
+        if (readHeader(row, &h) && (!found || (int32_t) (h.seq - newest.seq) > 0)){
+            newest = h;
+            headRow = row;
+            found = true;
+        }
+    }
+    if (!found){
+        return format();
+    }
+
+    //newest record: records in a row are consecutive up to the first blank or torn page
+    uint32_t last = headRow;
+    for (uint32_t page = headRow + _pageSize; page < headRow + _rowSize; page += _pageSize){
+        Header h;
+        if (!readHeader(page, &h) || h.seq != newest.seq + 1) break;
+        newest = h;
+        last = page;
+    }
+    _headSeq = newest.seq + 1;
+    _headAddr = nextPage(last);
+    if (!isBlank(_headAddr, _pageSize)){
+        //torn page: the rest of its row is skipped
+        _headAddr = nextRow(_headAddr);
+    }
+    if (_headAddr % _rowSize == 0 && !isBlank(_headAddr, _rowSize) && !_flash.erase(_headAddr)){
+        //reset before advance() erased the row
+        return false;
+    }
+    _tailSeq = newest.tail;
+    locateTail();
+    rewind();
+    return true;
+}
+
+bool FlashLog::format()
+{
+    bool ok = true;
+    for (uint32_t row = 0; row < _size; row += _rowSize){
+        ok = _flash.erase(row) && ok;
+    }
+    _headAddr = 0;
+    _tailAddr = 0;
+    _tailSeq = _headSeq;
+    rewind();
+    return ok;
+}
+
+//tail address from its sequence number: rows are visited oldest first
+void FlashLog::locateTail()
+{
+    if ((int32_t) (_headSeq - _tailSeq) <= 0){
+        _tailAddr = _headAddr;
+        _tailSeq = _headSeq;
+        return;
+    }
+    uint32_t oldest = nextRow(_headAddr);
+    uint32_t row = oldest;
+    bool found = false;
+    Header h;
+    //last row starting at or before the tail
+    for (uint32_t i = 0; i < _size / _rowSize; i++, row = nextRow(row)){
+        if (readHeader(row, &h) && (int32_t) (h.seq - _tailSeq) <= 0){
+            _tailAddr = row;
+            found = true;
+        }
+    }
+    if (!found){
+        //the tail row was overwritten: start from the oldest record left
+        _tailAddr = _headAddr;
+        _tailSeq = _headSeq;
+        row = oldest;
+        for (uint32_t i = 0; i < _size / _rowSize; i++, row = nextRow(row)){
+            if (readHeader(row, &h)){
+                _tailAddr = row;
+                _tailSeq = h.seq;
+                break;
+            }
+        }
+        return;
+    }
+    while (_tailAddr != _headAddr){
+        if (!readHeader(_tailAddr, &h)){
+            _tailAddr = nextRow(_tailAddr);
+            continue;
+        }
+        if ((int32_t) (h.seq - _tailSeq) >= 0){
+            _tailSeq = h.seq;
+            return;
+        }
+        _tailAddr = nextPage(_tailAddr);
+    }
+    _tailSeq = _headSeq;
+}
+
+bool FlashLog::append(const void* data, uint8_t len)
+{
+    return appendRecord(FLASH_LOG_DATA, _tailSeq, data, len);
+}
+
+bool FlashLog::appendRecord(uint8_t type, uint32_t tail, const void* data, uint8_t len)
+{
+    if (_pageSize == 0 || len > payloadMax()) return false;
+
+    //a failed page ends its row, the record goes to the next one
+    for (uint8_t attempt = 0; attempt < 2; attempt++){
+        if ((int32_t) (tail - _tailSeq) < 0){
+            tail = _tailSeq;
+        }
+        uint8_t page[FLASH_LOG_PAGE_MAX];
+        memset(page, 0xFF, sizeof(page));
+        Header header;
+        header.seq = _headSeq;
+        header.tail = tail;
+        header.len = len;
+        header.type = type;
+        memcpy(page, &header, FLASH_LOG_HEADER_SIZE);
+        memcpy(page + FLASH_LOG_HEADER_SIZE, data, len);
+        header.crc = crc16(0xFFFF, page, FLASH_LOG_HEADER_SIZE - 2);
+        header.crc = crc16(header.crc, page + FLASH_LOG_HEADER_SIZE, len);
+        memcpy(page, &header, FLASH_LOG_HEADER_SIZE);
+
+        //whole words, the rest of the page stays erased
+        if (_flash.write(_headAddr, page, (FLASH_LOG_HEADER_SIZE + len + 3) & ~3)){
+            _headSeq++;
+            advance(nextPage(_headAddr));
+            return true;
+        }
+        advance(nextRow(_headAddr));
+    }
+    return false;
+}
+
+//moves the head, erasing the row it enters: the head always points to an erased page
+void FlashLog::advance(uint32_t address)
+{
+    _headAddr = address;
+    for (uint32_t rows = _size / _rowSize; _headAddr % _rowSize == 0 && rows > 0; rows--){
+        //the oldest row is overwritten: the tail moves to the next oldest record
+        if (!empty() && _tailAddr - _tailAddr % _rowSize == _headAddr){
+            Header h;
+            uint32_t seq = _headSeq;
+            uint32_t next = nextRow(_headAddr);
+            for (; next != _headAddr; next = nextRow(next)){
+                if (readHeader(next, &h)){
+                    seq = h.seq;
+                    break;
+                }
+            }
+            _dropped += seq - _tailSeq;
+            _tailAddr = next;
+            _tailSeq = seq;
+        }
+        if (_readAddr - _readAddr % _rowSize == _headAddr && _readSeq != _headSeq){
+            rewind();
+        }
+        if (_flash.erase(_headAddr)) return;
+        _headAddr = nextRow(_headAddr);
+    }
+}
+
+int FlashLog::read(void* data, uint8_t size)
+{
+    uint8_t payload[FLASH_LOG_PAGE_MAX];
+    for (uint32_t pages = _size / _pageSize; _readAddr != _headAddr && pages > 0; pages--){
+        Header h;
+        if (!readHeader(_readAddr, &h, payload) || (int32_t) (h.seq - _readSeq) < 0){
+            _readAddr = nextRow(_readAddr);
+            continue;
+        }
+        _readAddr = nextPage(_readAddr);
+        _readSeq = h.seq + 1;
+        if (h.type == FLASH_LOG_DATA){
+            memcpy(data, payload, h.len < size ? h.len : size);
+            return h.len;
+        }
+    }
+    return -1;
+}
+
+void FlashLog::rewind()
+{
+    _readAddr = _tailAddr;
+    _readSeq = _tailSeq;
+}
+
+bool FlashLog::trim()
+{
+    if (_readSeq == _tailSeq) return true;
+    //with everything consumed, the trim record itself is consumed too
+    bool all = _readAddr == _headAddr;
+    _tailAddr = _readAddr;
+    _tailSeq = _readSeq;
+    if (!appendRecord(FLASH_LOG_TRIM, all ? _headSeq + 1 : _tailSeq, NULL, 0)){
+        return false;
+    }
+    if (all){
+        _tailAddr = _headAddr;
+        _tailSeq = _headSeq;
+        rewind();
+    }
+    return true;
+}
+
+bool FlashLog::readHeader(uint32_t address, Header* header, uint8_t* payload)
+{
+    uint8_t page[FLASH_LOG_PAGE_MAX];
+    _flash.read(address, page, _pageSize);
+    memcpy(header, page, FLASH_LOG_HEADER_SIZE);
+    if ((header->type != FLASH_LOG_DATA && header->type != FLASH_LOG_TRIM) || header->len > payloadMax()){
+        return false;
+    }
+    uint16_t crc = crc16(0xFFFF, page, FLASH_LOG_HEADER_SIZE - 2);
+    crc = crc16(crc, page + FLASH_LOG_HEADER_SIZE, header->len);
+    if (crc != header->crc) return false;
+    if (payload != NULL){
+        memcpy(payload, page + FLASH_LOG_HEADER_SIZE, header->len);
+    }
+    return true;
+}
+
+bool FlashLog::isBlank(uint32_t address, uint16_t len)
+{
+    uint8_t page[FLASH_LOG_PAGE_MAX];
+    for (uint16_t offset = 0; offset < len; offset += _pageSize){
+        _flash.read(address + offset, page, _pageSize);
+        for (uint16_t i = 0; i < _pageSize; i++){
+            if (page[i] != 0xFF) return false;
+        }
+    }
+    return true;
+}
+
+uint32_t FlashLog::nextPage(uint32_t address) const
+{
+    address += _pageSize;
+    return address >= _size ? 0 : address;
+}
+
+uint32_t FlashLog::nextRow(uint32_t address) const
+{
+    address += _rowSize - address % _rowSize;
+    return address >= _size ? 0 : address;
+}
@@ -1,8 +1,18 @@
 #include "GPRS.h"
+#include "Crc16.h"
 
 enum {
     GPRS_STATE_IDLE,
 
+    GPRS_STATE_CHECK_STATUS,
+    GPRS_STATE_WAIT_CHECK_STATUS_RESPONSE,
+
+    GPRS_STATE_SHUT_CONTEXT,
+    GPRS_STATE_WAIT_SHUT_CONTEXT_RESPONSE,
+
+    GPRS_STATE_CHECK_ATTACH,
+    GPRS_STATE_WAIT_CHECK_ATTACH_RESPONSE,
+
     GPRS_STATE_ATTACH,
     GPRS_STATE_WAIT_ATTACH_RESPONSE,
 
@@ -28,27 +38,46 @@ GPRS::GPRS():
     _username(NULL),
     _password(NULL),
     _state(GPRS_OFF),
-    _timeout(0)
+    _readyState(GPRS_STATE_IDLE),
+    _timeout(0),
+    _context(NO_CONTEXT),
+    _attachStart(0),
+    _timeToIP(0)
 {
 }
 
+//fingerprint of the PDP context settings, to tell whether an active bearer was set up with them
+static uint16_t contextCrc(const char* apn, const char* user_name, const char* password)
+{
+    const char* fields[] = {apn, user_name, password};
+    uint16_t crc = 0xFFFF;
+    for (uint8_t i = 0; i < 3; i++){
+        const char* field = fields[i] != NULL ? fields[i] : "";
+        crc = crc16(crc, (const uint8_t*) field, strlen(field) + 1);
+    }
+    return crc == GPRS::NO_CONTEXT ? crc - 1 : crc;
+}
+
 NetworkStatus GPRS::attachGPRS(const char* apn, const char* user_name, const char* password, bool synchronous)
 {
     _apn = apn;
     _username = user_name;
     _password = password;
 
-    _readyState = GPRS_STATE_ATTACH;
+    //the bearer may have survived a sleep: start from what the modem reports, not from scratch
+    _readyState = GPRS_STATE_CHECK_STATUS;
     _state = CONNECTING;
+    _attachStart = millis();
 
     if (synchronous) {
         unsigned long start = millis();
+        //ready() polls the modem: each step starts within 1 ms of the previous one being answered
         while (ready() == 0) {
             if (_timeout && !((millis() - start) < _timeout)) {
                 _state = ERROR;
                 break;
             }
-            delay(100);
+            delay(1);
         }
     } else {
         ready();
@@ -83,6 +112,78 @@ uint8_t GPRS::ready()
         break;
     }
 
+    case GPRS_STATE_CHECK_STATUS: {
+        MODEM.setResponseDataStorage(&_response);
+        MODEM.send("AT+CIPSTATUS");
+        _readyState = GPRS_STATE_WAIT_CHECK_STATUS_RESPONSE;
+        ready = 0;
+        break;
+    }
+
+    case GPRS_STATE_WAIT_CHECK_STATUS_RESPONSE: {
+        uint16_t context = contextCrc(_apn, _username, _password);
+        //unknown context (e.g. after a reset of the board): an active bearer is taken as ours
+        bool sameContext = _context == NO_CONTEXT || _context == context;
+        uint8_t result = ready;
+        ready = 0;
+        if (result > 1) {
+            _readyState = GPRS_STATE_CHECK_ATTACH;
+        } else if (_response.contains("IP GPRSACT") || _response.contains("IP STATUS")
+            || _response.contains("IP PROCESSING") || _response.contains("CONNECT")
+            || _response.contains("CLOS")) {
+            //bearer up, with an IP address
+            _readyState = sameContext ? GPRS_STATE_IDLE : GPRS_STATE_SHUT_CONTEXT;
+            if (sameContext) {
+                ready = 1;
+                attached(context);
+            }
+        } else if (_response.contains("IP START") && sameContext) {
+            //CSTT done, CIICR not
+            _readyState = GPRS_STATE_ACTIVATE_IP;
+        } else if (_response.contains("IP INITIAL")) {
+            _readyState = GPRS_STATE_CHECK_ATTACH;
+        } else {
+            //IP START with other settings, IP CONFIG, PDP DEACT: only a CIPSHUT gets out of these
+            _readyState = GPRS_STATE_SHUT_CONTEXT;
+        }
+        break;
+    }
+
+    case GPRS_STATE_SHUT_CONTEXT: {
+        MODEM.send("AT+CIPSHUT");
+        _readyState = GPRS_STATE_WAIT_SHUT_CONTEXT_RESPONSE;
+        ready = 0;
+        break;
+    }
+
+    case GPRS_STATE_WAIT_SHUT_CONTEXT_RESPONSE: {
+        _context = NO_CONTEXT;
+        if (ready > 1) {
+            _readyState = GPRS_STATE_IDLE;
+            _state = ERROR;
+        } else {
+            _readyState = GPRS_STATE_CHECK_ATTACH;
+            ready = 0;
+        }
+        break;
+    }
+
+    case GPRS_STATE_CHECK_ATTACH: {
+        MODEM.setResponseDataStorage(&_response);
+        MODEM.send("AT+CGATT?");
+        _readyState = GPRS_STATE_WAIT_CHECK_ATTACH_RESPONSE;
+        ready = 0;
+        break;
+    }
+
+    case GPRS_STATE_WAIT_CHECK_ATTACH_RESPONSE: {
+        long attached;
+        bool attachedToNetwork = ready == 1 && _response.intAfter("+CGATT:", &attached) && attached == 1;
+        _readyState = attachedToNetwork ? GPRS_STATE_SET_PDP_CONTEXT : GPRS_STATE_ATTACH;
+        ready = 0;
+        break;
+    }
+
     case GPRS_STATE_ATTACH: {
         MODEM.send("AT+CGATT=1");
         _readyState = GPRS_STATE_WAIT_ATTACH_RESPONSE;
@@ -101,7 +202,7 @@ uint8_t GPRS::ready()
         break;
     }
     case GPRS_STATE_SET_PDP_CONTEXT: {
-        MODEM.sendf("AT+CIPMUX=1"); //enable 8 sockets or simultaneous connections
+        MODEM.send("AT+CIPMUX=1"); //enable 8 sockets or simultaneous connections
         _readyState = GPRS_STATE_WAIT_SET_PDP_CONTEXT_RESPONSE;
         ready = 0;
         break;
@@ -119,7 +220,7 @@ uint8_t GPRS::ready()
     }
 
     case GPRS_STATE_SET_USERNAME_PASSWORD: {
-        MODEM.sendf("AT+CSTT=\"%s\",\"%s\",\"%s\"", _apn, _username, _password);
+        MODEM.send("AT+CSTT=", ModemQuoted(_apn), ',', ModemQuoted(_username), ',', ModemQuoted(_password));
         _readyState = GPRS_STATE_WAIT_SET_USERNAME_PASSWORD_RESPONSE;
         ready = 0;
         break;
@@ -148,12 +249,13 @@ uint8_t GPRS::ready()
         if (ready > 1) {
             _state = ERROR;
         } else {
-            _state = GPRS_READY;
+            attached(contextCrc(_apn, _username, _password));
         }
         break;
     }
 
     case GPRS_STATE_DEACTIVATE_IP: {
+        _context = NO_CONTEXT;
         MODEM.send("AT+CIPSHUT");
         _readyState = GPRS_STATE_WAIT_DEACTIVATE_IP_RESPONSE;
         ready = 0;
@@ -191,14 +293,23 @@ uint8_t GPRS::ready()
     return ready;
 }
 
+void GPRS::attached(uint16_t context)
+{
+    _context = context;
+    _state = GPRS_READY;
+    _timeToIP = millis() - _attachStart;
+    DBG("#DEBUG# bearer up in ", _timeToIP, " ms");
+}
+
 IPAddress GPRS::getIPAddress()
 {
-    String response;
+    ModemResponse response;
     MODEM.send("AT+CIFSR?");
     if (MODEM.waitForResponse(100, &response) == 1) {
-        response = response.substring(0, response.indexOf("\r")); //remove response code OK
+        char address[16];
+        response.line().copyTo(address, sizeof(address)); //without the response code OK
         IPAddress ip;
-        if (ip.fromString(response)) {
+        if (ip.fromString(address)) {
             return ip;
         }
     }
@@ -215,7 +326,23 @@ NetworkStatus GPRS::status()
     return _state;
 }
 
-bool GPRS::connect(const char* host, uint16_t port, uint8_t* mux, unsigned long timeout_s, ConnectionStatus* status) 
+bool GPRS::connect(const char* host, uint16_t port, uint8_t* mux, unsigned long timeout_s, ConnectionStatus* status,
+    Protocol protocol)
+{
+    ConnectionStatus result = ConnectionStatus::ERROR;
+    //CONNECT_ALREADY is passed through: the modem does not tell the mux, *mux is left as it is
+    if (connectAsync(host, port, mux, timeout_s, &result, protocol) && result == ConnectionStatus::PENDING){
+        while ((result = connectStatus(*mux)) == ConnectionStatus::PENDING){
+            delay(1);
+        }
+    }
+    if(status != NULL)
+        *status = result;
+    return result == ConnectionStatus::CONNECT_OK || result == ConnectionStatus::CONNECT_ALREADY;
+}
+
+bool GPRS::connectAsync(const char* host, uint16_t port, uint8_t* mux, unsigned long timeout_s, ConnectionStatus* status,
+    Protocol protocol)
 {
     if(MODEM._initSocks >= MAX_SOCKETS){
         if(status != NULL)
@@ -226,10 +353,14 @@ bool GPRS::connect(const char* host, uint16_t port, uint8_t* mux, unsigned long
     unsigned long start = millis();
     unsigned long timeout_ms = timeout_s * 1000;
     
-    String response;
-    MODEM.sendf("AT+CIPSTART=\"TCP\",\"%s\",%s", host, String(port).c_str());
+    ModemResponse response;
+    MODEM._connectInFlight = true;
+    MODEM._earlyConnect = 0;
+    MODEM.send("AT+CIPSTART=", protocol == Protocol::UDP ? "\"UDP\"," : "\"TCP\",", ModemQuoted(host), ',', port);
+    //"+CIPNUM:<mux>" then OK; the modem may hold the OK back until the connect result,
+    //which is taken out of the response by poll() either way
     int result = MODEM.waitForResponse(timeout_ms, &response);
-    //this response should contain either "CONNECT OK", "CONNECT FAIL", or "ALREADY CONNECT"
+    MODEM._connectInFlight = false;
 
     if (result == -1){
         if(status != NULL)
@@ -242,25 +373,43 @@ bool GPRS::connect(const char* host, uint16_t port, uint8_t* mux, unsigned long
         return false;
     }
 
-    if(response.indexOf(CONNECT_OK) != -1){
-        if(status != NULL)
-            *status = ConnectionStatus::CONNECT_OK;
-        uint8_t newMux = atoi(response.c_str() + 8);
-        *mux = newMux;
-        MODEM._sockets[newMux] = new GSM_Socket(newMux);
+    long num;
+    if(response.intAfter("+CIPNUM:", &num)){
+        uint8_t newMux = num >= 0 && num < MAX_SOCKETS ? num : MAX_SOCKETS;
+        if (newMux < MAX_SOCKETS && MODEM._sockets[newMux] != NULL && !MODEM._sockets[newMux]->connected()){
+            //the modem reuses the mux of a connection that ended, data still unread is lost
+            DBG("#DEBUG# socket ", newMux, " reused, ", MODEM._sockets[newMux]->available(), " bytes discarded");
+            release(newMux);
+        }
+        if (newMux >= MAX_SOCKETS || MODEM._sockets[newMux] != NULL){
+            if(status != NULL)
+                *status = ConnectionStatus::ERROR;
+            return false;
+        }
+        GSM_Socket* socket = GSM_Socket::acquire(newMux);
+        socket->_state = GSM_SOCKET_CONNECTING;
+        socket->_connectStart = start;
+        socket->_connectTimeout = timeout_ms;
+        if (MODEM._earlyConnect != 0 && (MODEM._earlyConnectMux < 0 || MODEM._earlyConnectMux == newMux)){
+            socket->_state = MODEM._earlyConnect > 0 ? GSM_SOCKET_OPEN : GSM_SOCKET_FAILED;
+        }
+        *mux = socket->handle();
+        MODEM._sockets[newMux] = socket;
         MODEM._initSocks++;
-        return true;
-    }
-    else if(response.indexOf(CONNECT_FAIL) != -1){
         if(status != NULL)
-            *status = ConnectionStatus::CONNECT_FAIL;
-        return false;
+            *status = ConnectionStatus::PENDING;
+        return true;
     }
-    else if(response.indexOf(CONNECT_ALREADY) != -1){
+    else if(response.contains(CONNECT_ALREADY)){
         if(status != NULL)
             *status = ConnectionStatus::CONNECT_ALREADY;
         return true;
     }
+    else if(MODEM._earlyConnect < 0){
+        if(status != NULL)
+            *status = ConnectionStatus::CONNECT_FAIL;
+        return false;
+    }
     else{
         if(status != NULL)
             *status = ConnectionStatus::ERROR;
@@ -268,24 +417,127 @@ bool GPRS::connect(const char* host, uint16_t port, uint8_t* mux, unsigned long
     }
 }
 
+GPRS::ConnectionStatus GPRS::connectStatus(uint8_t mux)
+{
+    MODEM.poll();
+    GSM_Socket* socket = find(mux);
+    if (socket == NULL){
+        return ConnectionStatus::ERROR;
+    }
+    switch (socket->_state){
+        case GSM_SOCKET_OPEN:
+        case GSM_SOCKET_CLOSED: //connected, and already closed by the peer
+            return ConnectionStatus::CONNECT_OK;
+        case GSM_SOCKET_FAILED:
+            //the modem has already let the mux go
+            release(socket->_mux);
+            return ConnectionStatus::CONNECT_FAIL;
+        case GSM_SOCKET_CONNECTING:
+        default:
+            break;
+    }
+    if (millis() - socket->_connectStart < socket->_connectTimeout){
+        return ConnectionStatus::PENDING;
+    }
+    DBG("#DEBUG# connect timeout on socket ", socket->_mux);
+    MODEM.send("AT+CIPCLOSE=", socket->_mux);
+    MODEM.waitForResponse(1000);
+    release(socket->_mux);
+    return ConnectionStatus::TIMEOUT;
+}
+
+//a socket handle, NULL if its mux is free or was reused by a later connection
+GSM_Socket* GPRS::find(uint8_t handle)
+{
+    uint8_t mux = handle & GSM_SOCKET_MUX_MASK;
+    GSM_Socket* socket = mux < MAX_SOCKETS ? MODEM._sockets[mux] : NULL;
+    if (socket == NULL || socket->handle() != handle){
+        return NULL;
+    }
+    return socket;
+}
+
+//the socket goes back to the pool
+void GPRS::release(uint8_t mux)
+{
+    MODEM._sockets[mux] = NULL;
+    MODEM._initSocks--;
+    //end of the data session; a connect that failed, or a session that sent nothing, never turned echo off
+    if (MODEM._initSocks == 0 && !MODEM._echo){
+        MODEM.turnEcho(true);
+    }
+}
+
 bool GPRS::close(uint8_t mux, unsigned long timeout) //just closes the TCP connection
 {	
-    MODEM.sendf("AT+CIPCLOSE=%d", mux);
+    GSM_Socket* socket = find(mux);
+    if (socket == NULL){
+        return true; //freed when its end was read
+    }
+    if (!socket->connected()){
+        //the modem has already let the mux go
+        release(socket->_mux);
+        return true;
+    }
+    MODEM.send("AT+CIPCLOSE=", socket->_mux);
     int result = MODEM.waitForResponse(timeout);
     if (result == 1){
-        delete MODEM._sockets[mux];
-        MODEM._initSocks--;
+        release(socket->_mux);
         return true;
     }
     return false;
 }
 
-uint16_t GPRS::send(uint8_t mux, const void* buff, uint16_t len)
+uint16_t GPRS::send(uint8_t mux, const void* buff, uint16_t len, bool wait)
+{
+    GSM_Socket* socket = find(mux);
+    return socket != NULL && socket->connected() ? socket->send(buff, len, wait) : 0;
+}
+
+uint16_t GPRS::failedSends(uint8_t mux)
+{
+    MODEM.collectSend();
+    GSM_Socket* socket = find(mux);
+    return socket != NULL ? socket->_failedSends : 0;
+}
+
+int GPRS::read(uint8_t mux, void* buf, uint16_t len, unsigned long timeout, uint16_t minLen)
 {
-    return MODEM._sockets[mux]->send(buff, len);
+    GSM_Socket* socket = find(mux);
+    if (socket == NULL){
+        return -1;
+    }
+    int result = socket->read(buf, len, timeout, minLen);
+    if (result < 0){
+        //end of the connection reached: the mux is free
+        release(socket->_mux);
+    }
+    return result;
+}
+
+uint16_t GPRS::available(uint8_t mux)
+{
+    MODEM.poll();
+    GSM_Socket* socket = find(mux);
+    return socket != NULL ? socket->available() : 0;
+}
+
+GSM_SocketState GPRS::socketState(uint8_t mux)
+{
+    GSM_Socket* socket = find(mux);
+    return socket != NULL ? socket->_state : GSM_SOCKET_CLOSED;
+}
+
+uint8_t GPRS::peek(uint8_t mux, GSM_Span spans[2])
+{
+    GSM_Socket* socket = find(mux);
+    return socket != NULL ? socket->peek(spans) : 0;
 }
 
-uint16_t GPRS::read(uint8_t mux, void* buf, uint16_t len, unsigned long timeout)
+void GPRS::consume(uint8_t mux, uint16_t len)
 {
-    return MODEM._sockets[mux]->read(buf, len, timeout);
+    GSM_Socket* socket = find(mux);
+    if (socket != NULL){
+        socket->consume(len);
+    }
 }
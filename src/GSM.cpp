@@ -1,9 +1,9 @@
-#define _XOPEN_SOURCE
 #include <time.h>
 
 #include "modem.h"
 
 #include "GSM.h"
+#include "GSMClock.h"
 
 enum {
     READY_STATE_CHECK_SIM,
@@ -12,8 +12,10 @@ enum {
     READY_STATE_WAIT_UNLOCK_SIM_RESPONSE,
     READY_STATE_SET_PREFERRED_MESSAGE_FORMAT,
     READY_STATE_WAIT_SET_PREFERRED_MESSAGE_FORMAT_RESPONSE,
+    READY_STATE_ENABLE_REGISTRATION_REPORTS,
     READY_STATE_CHECK_REGISTRATION,
     READY_STATE_WAIT_CHECK_REGISTRATION_RESPONSE,
+    READY_STATE_WAIT_REGISTRATION,
     READY_STATE_IDLE
 };
 
@@ -26,10 +28,25 @@ GSM::GSM():
     _state(GSM_OFF),
     _readyState(0),
     _pin(NULL),
-    _timeout(0)
+    _timeout(0),
+    _registration(GSM_REGISTRATION_UNKNOWN),
+    _lac(0),
+    _cellId(0),
+    _registrationQuery(0),
+    _reports(false)
 {
 }
 
+GSM::~GSM()
+{
+    MODEM.removeUrcHandler(this);
+}
+
+static bool registered(uint8_t stat)
+{
+    return stat == 1 || stat == 5;
+}
+
 NetworkStatus GSM::init(const char* pin, bool restart, bool synchronous)
 {
     if ((restart && !MODEM.restart()) || (!restart && !MODEM.init())) {
@@ -56,15 +73,52 @@ NetworkStatus GSM::init(const char* pin, bool restart, bool synchronous)
 
 bool GSM::isAccessAlive()
 {
-    String response;
-    MODEM.send("AT+CREG?");
-    if (MODEM.waitForResponse(100, &response) == 1) {
-        int status = response.charAt(response.indexOf(',') + 1) - '0';
-        if (status == 1 || status == 5) {
-            return true;
+    MODEM.poll(); //reports still in the UART
+    if (!_reports) {
+        ModemResponse response;
+        MODEM.send("AT+CREG?");
+        if (MODEM.waitForResponse(100, &response) == 1) {
+            updateRegistration(response);
         }
     }
-    return false;
+    return registered(_registration);
+}
+
+void GSM::handleUrc(const void* data, uint16_t len)
+{
+    updateRegistration(ModemResponse(static_cast<const char*>(data), len));
+}
+
+/** Take the registration from a +CREG report "+CREG: <stat>[,<lac>,<ci>]" or from the
+    AT+CREG? response "+CREG: <n>,<stat>[,<lac>,<ci>]"
+*/
+bool GSM::updateRegistration(const ModemResponse& line)
+{
+    ModemResponse params = line.after(":");
+    long stat;
+    long second;
+    if (!params.field(0).toInt(&stat)) return false;
+    if (params.field(1).toInt(&second)) {
+        //response: the first parameter was the report mode
+        stat = second;
+    }
+    //"<lac>","<ci>" in hexadecimal, the only quoted parameters
+    uint32_t lac = 0;
+    uint32_t cellId = 0;
+    if (params.quoted(0).toHex(&lac)) {
+        params.quoted(1).toHex(&cellId);
+    }
+    if (stat != _registration) {
+        DBG("#DEBUG# registration ", _registration, " -> ", stat);
+    }
+    _registration = stat;
+    _lac = lac;
+    _cellId = cellId;
+    //after init() the status follows the network
+    if (_readyState == READY_STATE_IDLE && (_state == GSM_READY || _state == CONNECTING)) {
+        _state = registered(stat) ? GSM_READY : CONNECTING;
+    }
+    return true;
 }
 
 bool GSM::shutdown()
@@ -103,10 +157,10 @@ uint8_t GSM::ready()
             _readyState = READY_STATE_CHECK_SIM;
             ready = 0;
         } else {
-            if (_response.indexOf("READY") != -1) {
+            if (_response.contains("READY")) {
                 _readyState = READY_STATE_SET_PREFERRED_MESSAGE_FORMAT;
                 ready = 0;
-            } else if (_response.indexOf("SIM PIN") != -1) {
+            } else if (_response.contains("SIM PIN")) {
                 _readyState = READY_STATE_UNLOCK_SIM;
                 ready = 0;
             } else {
@@ -121,7 +175,7 @@ uint8_t GSM::ready()
     case READY_STATE_UNLOCK_SIM: {
         if (_pin != NULL) {
             MODEM.setResponseDataStorage(&_response);
-            MODEM.sendf("AT+CPIN=\"%s\"", _pin);
+            MODEM.send("AT+CPIN=", ModemQuoted(_pin));
 
             _readyState = READY_STATE_WAIT_UNLOCK_SIM_RESPONSE;
             ready = 0;
@@ -156,16 +210,29 @@ uint8_t GSM::ready()
             _state = ERROR;
             ready = 2;
         } else {
-            _readyState = READY_STATE_CHECK_REGISTRATION;
+            _readyState = READY_STATE_ENABLE_REGISTRATION_REPORTS;
             ready = 0;
         }
 
         break;
     }
 
+    case READY_STATE_ENABLE_REGISTRATION_REPORTS: {
+        //+CREG: <stat>,<lac>,<ci> on every change, followed by handleUrc()
+        MODEM.addUrcHandler(this, MODEM_URC_CREG);
+        MODEM.send("AT+CREG=2");
+        _readyState = READY_STATE_CHECK_REGISTRATION;
+        ready = 0;
+        break;
+    }
+
     case READY_STATE_CHECK_REGISTRATION: {
+        //result of AT+CREG=2, unless coming back for the fallback query:
+        //without reports the query still finds the registration
+        _reports = _reports || ready == 1;
         MODEM.setResponseDataStorage(&_response);
         MODEM.send("AT+CREG?");
+        _registrationQuery = millis();
         _readyState = READY_STATE_WAIT_CHECK_REGISTRATION_RESPONSE;
         ready = 0;
         break;
@@ -175,24 +242,31 @@ uint8_t GSM::ready()
         if (ready > 1) {
             _state = ERROR;
             ready = 2;
+            break;
+        }
+        updateRegistration(_response);
+        _readyState = READY_STATE_WAIT_REGISTRATION;
+        //the answer may already settle it
+    }
+    // fall through
+
+    case READY_STATE_WAIT_REGISTRATION: {
+        //the registration is updated by the reports: nothing is sent until the fallback query
+        if (registered(_registration)) {
+            _readyState = READY_STATE_IDLE;
+            _state = GSM_READY;
+            ready = 1;
+        } else if (_registration == 3) {
+            _state = ERROR;
+            ready = 2;
         } else {
-            int status = _response.charAt(_response.indexOf(',') + 1) - '0';
-
-            if (status == 0 || status == 4) {
-                _readyState = READY_STATE_CHECK_REGISTRATION;
-                ready = 0;
-            } else if (status == 1 || status == 5) {
-                _readyState = READY_STATE_IDLE;
-                _state = GSM_READY;
-                ready = 1;
-            } else if (status == 2) {
-                _readyState = READY_STATE_CHECK_REGISTRATION;
+            if (_registration == 2) {
                 _state = CONNECTING;
-                ready = 0;
-            } else if (status == 3) {
-                _state = ERROR;
-                ready = 2;
             }
+            if (millis() - _registrationQuery >= GSM_REGISTRATION_POLL_MS) {
+                _readyState = READY_STATE_CHECK_REGISTRATION;
+            }
+            ready = 0;
         }
         break;
     }
@@ -209,59 +283,39 @@ void GSM::setTimeout(unsigned long timeout)
     _timeout = timeout;
 }
 
+//each call is a modem round trip, GSMClock keeps the time without one
 unsigned long GSM::getTime() //UTC
 {
-    String response;
+    ModemResponse response;
+    uint32_t utc;
+    int8_t zone;
 
     MODEM.send(F("AT+CCLK?"));
-    if (MODEM.waitForResponse(100, &response) != 1) {
+    if (MODEM.waitForResponse(100, &response) != 1 || !GSMClock::parse(response, &utc, &zone)) {
         return 0;
     }
-
-    struct tm now;
-
-    if (strptime(response.c_str(), CLOCK_FORMAT, &now) != NULL) {
-        // adjust for timezone offset which is +/- in 15 minute increments
-
-        time_t result = mktime(&now);
-        time_t delta = ((response.charAt(26) - '0') * 10 + (response.charAt(27) - '0')) * (15 * 60);
-
-        if (response.charAt(25) == '-') {
-            result += delta;
-        } else if (response.charAt(25) == '+') {
-            result -= delta;
-        }
-
-        return result;
-    }
-
-    return 0;
+    return utc;
 }
 
 unsigned long GSM::getLocalTime()
 {
-    String response;
+    ModemResponse response;
+    uint32_t utc;
+    int8_t zone;
 
     MODEM.send(F("AT+CCLK?"));
-    if (MODEM.waitForResponse(100, &response) != 1) {
+    if (MODEM.waitForResponse(100, &response) != 1 || !GSMClock::parse(response, &utc, &zone)) {
         return 0;
     }
-
-    struct tm now;
-
-    if (strptime(response.c_str(), CLOCK_FORMAT, &now) != NULL) {
-        time_t result = mktime(&now);
-        return result;
-    }
-
-    return 0;
+    return utc + zone * (15 * 60L);
 }
 
 bool GSM::setLocalTime(time_t time, uint8_t quarters_from_utc){ //time is UTC
 
     struct tm * now = localtime(&time);
-    MODEM.sendf("AT+CCLK=\"%.2d/%.2d/%.2d,%.2d:%.2d:%.2d%+.2d\"",
-                (now->tm_year + 1900) % 100, now->tm_mon + 1, now->tm_mday, now->tm_hour, now->tm_min, now->tm_sec % 60, quarters_from_utc);
+    MODEM.send("AT+CCLK=\"", ModemPadded((now->tm_year + 1900) % 100, 2), '/', ModemPadded(now->tm_mon + 1, 2), '/',
+                ModemPadded(now->tm_mday, 2), ',', ModemPadded(now->tm_hour, 2), ':', ModemPadded(now->tm_min, 2), ':',
+                ModemPadded(now->tm_sec % 60, 2), ModemPadded(quarters_from_utc, 2, true), '"');
     return MODEM.waitForResponse() == 1;
 }
 
@@ -283,11 +337,11 @@ NetworkStatus GSM::status()
 int8_t GSM::getSignalQuality(unsigned long timeout)
 {
     MODEM.send(F("AT+CSQ"));
-    String response;
-    uint8_t result = MODEM.waitForResponse(timeout, &response);
-    if (result != 1) return 99;
+    ModemResponse response;
+    long rssi;
+    if (MODEM.waitForResponse(timeout, &response) != 1 || !response.intAfter("+CSQ:", &rssi)) return 99;
     else{
-        return 2*(atoi(response.c_str() + 6)-2) - 109; //result in dBm
+        return 2*(rssi-2) - 109; //result in dBm
     }
 }
 
@@ -308,6 +362,7 @@ const char * GSM::signal2String(int8_t signalQuality)
 
 bool GSM::waitForNetwork(unsigned long timeout, int8_t * signal)
 {
+    //isAccessAlive() only reads the UART for reports
     for (unsigned long start = millis(); millis() - start < timeout;) {
         if (isAccessAlive()){
             if (signal != NULL){
@@ -315,7 +370,7 @@ bool GSM::waitForNetwork(unsigned long timeout, int8_t * signal)
             }
             return true;
         }
-        delay(250);
+        delay(10);
     }
     return false;
 }
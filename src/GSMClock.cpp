@@ -0,0 +1,112 @@
+#include "GSMClock.h"
+
+#include "CivilTime.h"
+
+//two decimal digits, then the expected separator (none if 0)
+static bool readField(const char** p, uint8_t* value, char separator)
+{
+    const char* s = *p;
+    if (s[0] < '0' || s[0] > '9' || s[1] < '0' || s[1] > '9') return false;
+    *value = (s[0] - '0') * 10 + (s[1] - '0');
+    s += 2;
+    if (separator != 0 && *s++ != separator) return false;
+    *p = s;
+    return true;
+}
+
+GSMClock::GSMClock(unsigned long resyncMs):
+    _resyncMs(resyncMs),
+    _epoch(0),
+    _anchorMillis(0),
+    _syncMillis(0),
+    _zone(0),
+    _synced(false),
+    _queued(false)
+{
+    MODEM.addUrcHandler(this, MODEM_URC_CTZV);
+}
+
+GSMClock::~GSMClock()
+{
+    MODEM.removeUrcHandler(this);
+}
+
+bool GSMClock::parse(const ModemResponse& response, uint32_t* utc, int8_t* zone)
+{
+    char time[24];
+    if (response.after("+CCLK:").quoted().copyTo(time, sizeof(time)) == 0) return false;
+    const char* p = time;
+    uint8_t year, month, day, hour, minute, second;
+    if (!readField(&p, &year, '/') || !readField(&p, &month, '/') || !readField(&p, &day, ',') ||
+        !readField(&p, &hour, ':') || !readField(&p, &minute, ':') || !readField(&p, &second, 0)){
+        return false;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 59){
+        return false;
+    }
+    uint8_t quarters = 0;
+    char sign = *p;
+    if ((sign == '+' || sign == '-') && (p++, !readField(&p, &quarters, 0))){
+        return false;
+    }
+    *zone = sign == '-' ? -quarters : quarters;
+    //the modem keeps local time
+    *utc = civilToEpoch(2000 + year, month, day, hour, minute, second) - *zone * (15 * 60L);
+    return true;
+}
+
+bool GSMClock::anchor(const ModemResponse& response)
+{
+    uint32_t utc;
+    int8_t zone;
+    if (!parse(response, &utc, &zone)){
+        DBG("#DEBUG# invalid clock: ", response.data());
+        return false;
+    }
+    _epoch = utc;
+    _zone = zone;
+    _anchorMillis = millis();
+    _syncMillis = _anchorMillis + _resyncMs;
+    _synced = true;
+    return true;
+}
+
+bool GSMClock::sync(unsigned long timeout)
+{
+    ModemResponse response;
+    MODEM.send(F("AT+CCLK?"));
+    if (MODEM.waitForResponse(timeout, &response) != 1) {
+        return false;
+    }
+    return anchor(response);
+}
+
+uint32_t GSMClock::now()
+{
+    unsigned long ms = millis();
+    if (!_queued && (long) (ms - _syncMillis) >= 0){
+        _queued = MODEM.enqueue("AT+CCLK?", GSM_CLOCK_QUERY_TIMEOUT_MS, onTime, this);
+    }
+    return _synced ? _epoch + (ms - _anchorMillis) / 1000 : 0;
+}
+
+uint32_t GSMClock::localNow()
+{
+    uint32_t utc = now();
+    return utc != 0 ? utc + _zone * (15 * 60L) : 0;
+}
+
+void GSMClock::onTime(int result, const ModemResponse& response, void* context)
+{
+    GSMClock* clock = static_cast<GSMClock*>(context);
+    clock->_queued = false;
+    if (result != 1 || !clock->anchor(response)){
+        clock->_syncMillis = millis() + GSM_CLOCK_RETRY_MS;
+    }
+}
+
+void GSMClock::handleUrc(const void* /*data*/, uint16_t /*len*/)
+{
+    //network time and zone update: resync at the next now()
+    _syncMillis = millis();
+}
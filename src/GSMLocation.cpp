@@ -1,18 +1,10 @@
 #include "GSMLocation.h"
 
-#define GSM_LOCATION_UPDATE_INTERVAL_MIN 1000*60
-#define GSM_LOCATION_UPDATE_INTERVAL_HOUR 1000*3600
-
 GSMLocation::GSMLocation() :
-    _commandSent(false),
-    _locationAvailable(false),
-    _latitude(0),
-    _longitude(0),
-    _altitude(0),
-    _on(false),
-    _uncertainty(0)
+    _on(false)
 {
-    MODEM.addUrcHandler(this);
+    MODEM.addUrcHandler(this, MODEM_URC_GPSRD);
+    MODEM.addUrcHandler(this, MODEM_URC_NMEA);
 }
 
 GSMLocation::~GSMLocation()
@@ -20,16 +12,19 @@ GSMLocation::~GSMLocation()
     MODEM.removeUrcHandler(this);
 }
 
-bool GSMLocation::set(bool on)
+bool GSMLocation::set(bool on, uint8_t interval_s)
 {
     if(!_on && on){
         MODEM.send("AT+AGPS=1"); //TODO THIS ACTUALLY RESPONDS WITH THREE REPLIES
-        if(MODEM.waitForResponse() == 1){
-            _on = true;
-            return true;
-        }
+        if(MODEM.waitForResponse() != 1) return false;
+        _on = true;
+        //NMEA sentences are then reported as +GPSRD URCs
+        MODEM.send("AT+GPSRD=", interval_s);
+        return MODEM.waitForResponse() == 1;
     }
     else if(_on && !on){
+        MODEM.send("AT+GPSRD=0");
+        MODEM.waitForResponse();
         MODEM.send("AT+AGPS=0");
         if(MODEM.waitForResponse() == 1){
             _on = false;
@@ -43,52 +38,45 @@ bool GSMLocation::set(bool on)
 
 bool GSMLocation::available()
 {
-    if (!_commandSent) {
-        _commandSent = true;
-        _locationAvailable = false;
-
-        MODEM.send("AT+LOCATION=2");
-        MODEM.waitForResponse();
-    }
-
     MODEM.poll();
-
-    if (_locationAvailable) {
-        _commandSent = false;
-        _locationAvailable = false;
-        return true;
-    }
-
-    return false;
+    return _parser.updated();
 }
 
 float GSMLocation::latitude()
 {
-    return _latitude;
+    return _parser.fix().latitude / 1e6f;
 }
 
 float GSMLocation::longitude()
 {
-    return _longitude;
+    return _parser.fix().longitude / 1e6f;
 }
 
 long GSMLocation::altitude()
 {
-    return _altitude;
+    return (_parser.fix().altitude + (_parser.fix().altitude >= 0 ? 5 : -5)) / 10;
 }
 
 long GSMLocation::accuracy()
 {
-    return _uncertainty;
+    return _parser.accuracy();
 }
 
-void GSMLocation::handleUrc(const String& urc)
+void GSMLocation::fix(PositionFix* fix)
 {
-    if (urc.startsWith("????")) { //TODO
-        
-
-        _locationAvailable = true;
-
+    fix->latitude = _parser.fix().latitude;
+    fix->longitude = _parser.fix().longitude;
+    fix->altitude = altitude();
+    fix->accuracy = _parser.accuracy();
+    fix->timestamp = _parser.epoch();
+}
 
+void GSMLocation::handleUrc(const void* data, uint16_t len)
+{
+    //the first sentence of a report comes as "+GPSRD:$GPGGA,...", the following ones as "$GP..."
+    const char* line = reinterpret_cast<const char*>(data);
+    const char* sentence = reinterpret_cast<const char*>(memchr(line, '$', len));
+    if (sentence != NULL){
+        _parser.feed(sentence, len - (sentence - line));
     }
 }
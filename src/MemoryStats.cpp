@@ -0,0 +1,204 @@
+#include "MemoryStats.h"
+
+#include <malloc.h>
+
+#include "socket.h"
+#include "Varint.h"
+
+#define MEMORY_STATS_VERSION 0x01
+
+#if defined(ARDUINO_ARCH_SAMD)
+
+//linker script symbols
+extern "C" char __StackTop;
+extern "C" char __data_start__, __data_end__, __bss_start__, __bss_end__;
+extern "C" char* sbrk(int incr);
+
+//newlib-nano free list: chunks of size bytes (header included), in address order
+struct FreeChunk {
+    long size;
+    FreeChunk* next;
+};
+extern "C" FreeChunk* __malloc_free_list;
+
+static const char* stackPointer() { return reinterpret_cast<const char*>(__get_MSP()); }
+static const char* stackTop() { return &__StackTop; }
+//the stack cannot go below the heap
+static const char* heapTop() { return sbrk(0); }
+
+static uint32_t staticBytes()
+{
+    return (&__data_end__ - &__data_start__) + (&__bss_end__ - &__bss_start__);
+}
+
+static void heapUsage(uint32_t* used, uint32_t* arena, uint32_t* free, uint32_t* largest)
+{
+    struct mallinfo info = mallinfo();
+    *used = info.uordblks;
+    *arena = info.arena;
+    *free = info.fordblks;
+    *largest = 0;
+    for (FreeChunk* chunk = __malloc_free_list; chunk != NULL; chunk = chunk->next){
+        if ((uint32_t) chunk->size > *largest) *largest = chunk->size;
+    }
+}
+
+#else
+
+//host build: the stack is measured from main() down, in a painted window of its own
+static const char* stackPointer() { return static_cast<const char*>(__builtin_frame_address(0)); }
+static const char* stackTop() { return stackPointer(); }
+static const char* heapTop() { return NULL; }
+static uint32_t staticBytes() { return 0; }
+
+//glibc keeps no single free list: the largest free block is taken as all the free bytes
+static void heapUsage(uint32_t* used, uint32_t* arena, uint32_t* free, uint32_t* largest)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    *used = info.uordblks;
+    *arena = info.arena;
+    *free = info.fordblks;
+    *largest = info.fordblks;
+}
+
+#endif
+
+MemoryStats::MemoryStats():
+    _stackTop(NULL),
+    _paintStart(NULL),
+    _paintEnd(NULL),
+    _heapUsed(0),
+    _heapSampledPeak(0),
+    _heapArena(0),
+    _heapFree(0),
+    _largestFree(0),
+    _staticCount(0)
+{
+    addStatic("modem", sizeof(ModemClass));
+    addStatic("sockets", GSM_Socket::poolBytes());
+}
+
+void MemoryStats::paintStack()
+{
+    const char* sp = stackPointer();
+    _stackTop = stackTop();
+#if defined(ARDUINO_ARCH_SAMD)
+    _paintStart = heapTop();
+#else
+    _paintStart = sp - MEMORY_HOST_STACK_WINDOW;
+#endif
+    _paintEnd = sp - MEMORY_STACK_GUARD;
+    for (volatile char* p = const_cast<char*>(_paintStart); p < _paintEnd; p++){
+        *p = MEMORY_STACK_PAINT;
+    }
+}
+
+//lowest stack byte written since paintStack(); the heap may have grown over the painted bytes below it
+const char* MemoryStats::lowestStackUse() const
+{
+    const char* p = _paintStart;
+    if (heapTop() > p) p = heapTop();
+    const volatile char* q = p;
+    while (q < _paintEnd && *q == (char) MEMORY_STACK_PAINT) q++;
+    return const_cast<const char*>(q);
+}
+
+uint32_t MemoryStats::stackPeak() const
+{
+    return _paintStart != NULL ? _stackTop - lowestStackUse() : 0;
+}
+
+uint32_t MemoryStats::headroom() const
+{
+    if (_paintStart == NULL) return 0;
+    const char* limit = heapTop() != NULL ? heapTop() : _paintStart;
+    return lowestStackUse() - limit;
+}
+
+uint32_t MemoryStats::freeRam() const
+{
+    const char* limit = heapTop() != NULL ? heapTop() : _paintStart;
+    return limit != NULL ? stackPointer() - limit : 0;
+}
+
+void MemoryStats::sample()
+{
+    heapUsage(&_heapUsed, &_heapArena, &_heapFree, &_largestFree);
+    if (_heapUsed > _heapSampledPeak) _heapSampledPeak = _heapUsed;
+}
+
+uint8_t MemoryStats::fragmentation() const
+{
+    return _heapFree != 0 ? 100 - (uint8_t) (100ULL * _largestFree / _heapFree) : 0;
+}
+
+bool MemoryStats::addStatic(const char* name, uint32_t bytes)
+{
+    if (_staticCount == MEMORY_STATIC_SLOTS) return false;
+    _staticNames[_staticCount] = name;
+    _staticBytes[_staticCount] = bytes;
+    _staticCount++;
+    return true;
+}
+
+uint32_t MemoryStats::staticTotal() const
+{
+    return staticBytes();
+}
+
+void MemoryStats::dump(Print& out)
+{
+    sample();
+    out.print(F("stack: peak "));
+    out.print(stackPeak());
+    out.print(F(" B, headroom "));
+    out.print(headroom());
+    out.print(F(" B, free now "));
+    out.print(freeRam());
+    out.println(F(" B"));
+    out.print(F("heap: used "));
+    out.print(_heapUsed);
+    out.print(F(" B (sampled peak "));
+    out.print(_heapSampledPeak);
+    out.print(F(" B), arena "));
+    out.print(_heapArena);
+    out.print(F(" B, free "));
+    out.print(_heapFree);
+    out.print(F(" B, largest free "));
+    out.print(_largestFree);
+    out.print(F(" B, fragmentation "));
+    out.print(fragmentation());
+    out.println(F("%"));
+    out.print(F("static: "));
+    out.print(staticTotal());
+    out.print(F(" B"));
+    for (uint8_t i = 0; i < _staticCount; i++){
+        out.print(i == 0 ? F(", ") : F(" + "));
+        out.print(_staticNames[i]);
+        out.print(' ');
+        out.print(_staticBytes[i]);
+        out.print(F(" B"));
+    }
+    out.println();
+}
+
+uint16_t MemoryStats::serialize(uint8_t* out, uint16_t size)
+{
+    sample();
+    uint16_t pos = 0;
+    bool ok = putVarint(out, size, &pos, MEMORY_STATS_VERSION) && putVarint(out, size, &pos, stackPeak())
+        && putVarint(out, size, &pos, headroom()) && putVarint(out, size, &pos, _heapUsed)
+        && putVarint(out, size, &pos, _heapSampledPeak) && putVarint(out, size, &pos, _heapArena)
+        && putVarint(out, size, &pos, _heapFree) && putVarint(out, size, &pos, _largestFree)
+        && putVarint(out, size, &pos, staticTotal()) && putVarint(out, size, &pos, _staticCount);
+    for (uint8_t i = 0; ok && i < _staticCount; i++){
+        ok = putVarint(out, size, &pos, _staticBytes[i]);
+    }
+    return ok ? pos : 0;
+}
+
+MemoryStats MEMORY_STATS;
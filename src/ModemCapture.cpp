@@ -0,0 +1,152 @@
+#include "ModemCapture.h"
+
+#define CAPTURE_NO_RECORD 0xFFFF
+#define CAPTURE_TX_BIT 0x80
+#define CAPTURE_LEN_MASK 0x7F
+//header byte + up to 5 bytes of varint delta
+#define CAPTURE_HEADER_MAX 6
+
+static void printHex(Print& out, uint8_t c)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    out.print(digits[c >> 4]);
+    out.print(digits[c & 0x0F]);
+}
+
+ModemCapture::ModemCapture(uint8_t* buffer, uint16_t size):
+    _buffer(buffer),
+    _size(size),
+    _maxRecord(min((uint16_t) CAPTURE_LEN_MASK, (uint16_t) (size / 2 - CAPTURE_HEADER_MAX))),
+    _tail(0),
+    _used(0),
+    _open(CAPTURE_NO_RECORD),
+    _openDirection(MODEM_CAPTURE_RX),
+    _firstMillis(0),
+    _lastMillis(0),
+    _lost(0)
+{
+}
+
+void ModemCapture::clear()
+{
+    _tail = 0;
+    _used = 0;
+    _open = CAPTURE_NO_RECORD;
+    _lost = 0;
+}
+
+void ModemCapture::record(ModemCaptureDirection direction, const uint8_t* data, uint16_t len)
+{
+    if (len == 0) return;
+    unsigned long now = millis();
+    for (uint16_t i = 0; i < len; i++){
+        if (_open == CAPTURE_NO_RECORD || direction != _openDirection || now != _lastMillis ||
+            (_buffer[_open] & CAPTURE_LEN_MASK) >= _maxRecord){
+            startRecord(direction, now);
+        }
+        else{
+            reserve(1);
+        }
+        put(data[i]);
+        _buffer[_open]++;
+    }
+}
+
+//opens an empty record, with room for its first byte
+void ModemCapture::startRecord(ModemCaptureDirection direction, unsigned long now)
+{
+    unsigned long delta = _used == 0 ? 0 : now - _lastMillis;
+    uint8_t varint[5];
+    uint8_t len = 0;
+    do {
+        varint[len] = delta & 0x7F;
+        delta >>= 7;
+        if (delta != 0) varint[len] |= 0x80;
+        len++;
+    } while (delta != 0);
+
+    //the record about to be written may push out the previous one, it is closed first
+    _open = CAPTURE_NO_RECORD;
+    reserve(1 + len + 1);
+    if (_used == 0){
+        _firstMillis = now;
+    }
+    _open = wrap((uint32_t) _tail + _used);
+    _openDirection = direction;
+    _lastMillis = now;
+    put(direction == MODEM_CAPTURE_TX ? CAPTURE_TX_BIT : 0);
+    for (uint8_t i = 0; i < len; i++){
+        put(varint[i]);
+    }
+}
+
+void ModemCapture::reserve(uint16_t len)
+{
+    while (_size - _used < len){
+        dropOldest();
+    }
+}
+
+void ModemCapture::dropOldest()
+{
+    unsigned long delta;
+    uint8_t len = _buffer[_tail] & CAPTURE_LEN_MASK;
+    uint16_t next = wrap((uint32_t) readVarint(wrap((uint32_t) _tail + 1), &delta) + len);
+    _used -= wrap((uint32_t) next + _size - _tail);
+    _lost += len;
+    _tail = next;
+    if (_used > 0){
+        //the next record becomes the oldest: its delta moves into the base time
+        readVarint(wrap((uint32_t) _tail + 1), &delta);
+        _firstMillis += delta;
+    }
+}
+
+void ModemCapture::put(uint8_t c)
+{
+    _buffer[wrap((uint32_t) _tail + _used)] = c;
+    _used++;
+}
+
+//returns the position after the varint
+uint16_t ModemCapture::readVarint(uint16_t pos, unsigned long* value) const
+{
+    *value = 0;
+    uint8_t shift = 0;
+    uint8_t c;
+    do {
+        c = _buffer[pos];
+        *value |= (unsigned long) (c & 0x7F) << shift;
+        shift += 7;
+        pos = wrap((uint32_t) pos + 1);
+    } while (c & 0x80);
+    return pos;
+}
+
+void ModemCapture::dump(Print& out) const
+{
+    out.println(F("# A9G capture v1"));
+    uint16_t pos = _tail;
+    uint16_t left = _used;
+    unsigned long time = _firstMillis;
+    bool first = true;
+    while (left > 0){
+        uint8_t header = _buffer[pos];
+        unsigned long delta;
+        uint16_t data = readVarint(wrap((uint32_t) pos + 1), &delta);
+        if (!first) time += delta;
+        first = false;
+        uint8_t len = header & CAPTURE_LEN_MASK;
+        out.print(header & CAPTURE_TX_BIT ? 'T' : 'R');
+        out.print(' ');
+        out.print(time);
+        out.print(' ');
+        for (uint8_t i = 0; i < len; i++){
+            printHex(out, _buffer[wrap((uint32_t) data + i)]);
+        }
+        out.println();
+        uint16_t next = wrap((uint32_t) data + len);
+        left -= wrap((uint32_t) next + _size - pos);
+        pos = next;
+    }
+}
@@ -0,0 +1,126 @@
+#include "ModemResponse.h"
+
+#include <string.h>
+
+int16_t ModemResponse::indexOf(const char* text) const
+{
+    uint16_t len = strlen(text);
+    if (len == 0) return 0;
+    for (uint16_t i = 0; i + len <= _len; i++){
+        if (_data[i] == text[0] && memcmp(_data + i, text, len) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+ModemResponse ModemResponse::line(uint8_t index) const
+{
+    uint16_t start = 0;
+    while (start < _len){
+        const char* end = static_cast<const char*>(memchr(_data + start, '\n', _len - start));
+        uint16_t next = end != NULL ? end - _data + 1 : _len;
+        uint16_t len = next - start;
+        while (len > 0 && (_data[start + len - 1] == '\r' || _data[start + len - 1] == '\n')){
+            len--;
+        }
+        if (len > 0 && index-- == 0){
+            return ModemResponse(_data + start, len);
+        }
+        start = next;
+    }
+    return ModemResponse();
+}
+
+ModemResponse ModemResponse::after(const char* prefix) const
+{
+    int16_t at = indexOf(prefix);
+    if (at < 0) return ModemResponse();
+    uint16_t start = at + strlen(prefix);
+    while (start < _len && _data[start] == ' ') start++;
+    uint16_t end = start;
+    while (end < _len && _data[end] != '\r' && _data[end] != '\n') end++;
+    return ModemResponse(_data + start, end - start);
+}
+
+ModemResponse ModemResponse::field(uint8_t index) const
+{
+    uint16_t start = 0;
+    bool quoted = false;
+    for (uint16_t i = 0; i <= _len; i++){
+        char c = i < _len ? _data[i] : '\n';
+        if (c == '"'){
+            quoted = !quoted;
+            continue;
+        }
+        if (quoted && c != '\r' && c != '\n') continue;
+        if (c != ',' && c != '\r' && c != '\n') continue;
+        if (index-- == 0){
+            uint16_t end = i;
+            while (start < end && _data[start] == ' ') start++;
+            while (end > start && _data[end - 1] == ' ') end--;
+            return ModemResponse(_data + start, end - start);
+        }
+        if (c != ',') break; //end of the first line
+        start = i + 1;
+    }
+    return ModemResponse();
+}
+
+ModemResponse ModemResponse::quoted(uint8_t index) const
+{
+    const char* p = _data;
+    const char* end = _data + _len;
+    while (p < end){
+        const char* open = static_cast<const char*>(memchr(p, '"', end - p));
+        if (open == NULL) break;
+        const char* close = static_cast<const char*>(memchr(open + 1, '"', end - open - 1));
+        if (close == NULL) break;
+        if (index-- == 0){
+            return ModemResponse(open + 1, close - open - 1);
+        }
+        p = close + 1;
+    }
+    return ModemResponse();
+}
+
+bool ModemResponse::toInt(long* value) const
+{
+    uint16_t i = 0;
+    bool negative = false;
+    if (i < _len && (_data[i] == '-' || _data[i] == '+')){
+        negative = _data[i++] == '-';
+    }
+    uint16_t digits = i;
+    long result = 0;
+    for (; i < _len && _data[i] >= '0' && _data[i] <= '9'; i++){
+        result = result * 10 + (_data[i] - '0');
+    }
+    if (i == digits) return false;
+    *value = negative ? -result : result;
+    return true;
+}
+
+bool ModemResponse::toHex(uint32_t* value) const
+{
+    uint32_t result = 0;
+    uint16_t i = 0;
+    for (; i < _len; i++){
+        char c = _data[i];
+        if (c >= '0' && c <= '9') result = (result << 4) | (c - '0');
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') result = (result << 4) | ((c | 0x20) - 'a' + 10);
+        else break;
+    }
+    if (i == 0) return false;
+    *value = result;
+    return true;
+}
+
+uint16_t ModemResponse::copyTo(char* dst, uint16_t size) const
+{
+    if (size == 0) return 0;
+    uint16_t len = _len < size - 1 ? _len : size - 1;
+    memcpy(dst, _data, len);
+    dst[len] = '\0';
+    return len;
+}
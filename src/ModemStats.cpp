@@ -0,0 +1,195 @@
+#include "ModemStats.h"
+#include "ModemUrc.h"
+#include "Varint.h"
+
+#define MODEM_STATS_VERSION 0x01
+
+#define MODEM_CMD_NAME(name) #name,
+static constexpr const char* COMMAND_NAMES[] = {
+    MODEM_CMD_LIST(MODEM_CMD_NAME)
+    "BASIC",
+    "OTHER"
+};
+#undef MODEM_CMD_NAME
+
+static constexpr bool namesSorted(const char* const* names, uint8_t count)
+{
+    return count < 2 || (modemPrefixLess(names[0], names[1]) && namesSorted(names + 1, count - 1));
+}
+
+static_assert(namesSorted(COMMAND_NAMES, MODEM_CMD_BASIC), "MODEM_CMD_LIST must be sorted");
+
+static const uint16_t BUCKET_LIMITS_MS[MODEM_STATS_BUCKETS - 1] = {10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000};
+
+static void increment(uint16_t* counter)
+{
+    if (*counter != 0xFFFF) (*counter)++;
+}
+
+//right aligned in width columns
+static void printColumn(Print& out, unsigned long value, uint8_t width)
+{
+    uint8_t digits = 1;
+    for (unsigned long v = value; v >= 10; v /= 10) digits++;
+    while (width-- > digits) out.print(' ');
+    out.print(value);
+}
+
+ModemStats::ModemStats()
+{
+    reset();
+}
+
+void ModemStats::reset()
+{
+    memset(_commands, 0, sizeof(_commands));
+    memset(_sockets, 0, sizeof(_sockets));
+    _pending = -1;
+    _start = 0;
+}
+
+ModemCommandClass ModemStats::classify(const char* command)
+{
+    if (command == NULL || command[0] != 'A' || command[1] != 'T') return MODEM_CMD_OTHER;
+    if (command[2] != '+') return MODEM_CMD_BASIC;
+    const char* name = command + 3;
+    uint8_t len = 0;
+    while (name[len] != '\0' && name[len] != '=' && name[len] != '?' && name[len] != '\r'){
+        len++;
+    }
+    uint8_t low = 0;
+    uint8_t high = MODEM_CMD_BASIC;
+    while (low < high){
+        uint8_t mid = (low + high) / 2;
+        int c = strncmp(name, COMMAND_NAMES[mid], len);
+        if (c == 0 && COMMAND_NAMES[mid][len] != '\0') c = -1; //shorter name
+        if (c == 0) return static_cast<ModemCommandClass>(mid);
+        if (c < 0) high = mid;
+        else low = mid + 1;
+    }
+    return MODEM_CMD_OTHER;
+}
+
+const char* ModemStats::name(ModemCommandClass command)
+{
+    return command < MODEM_CMD_COUNT ? COMMAND_NAMES[command] : "";
+}
+
+void ModemStats::start(const char* command)
+{
+    _pending = classify(command);
+    _start = millis();
+}
+
+void ModemStats::result(uint8_t code)
+{
+    if (_pending < 0) return;
+    ModemCommandStats& stats = _commands[_pending];
+    _pending = -1;
+    unsigned long elapsed = millis() - _start;
+    uint8_t bucket = 0;
+    while (bucket < MODEM_STATS_BUCKETS - 1 && elapsed >= BUCKET_LIMITS_MS[bucket]){
+        bucket++;
+    }
+    increment(&stats.buckets[bucket]);
+    if (elapsed > stats.maxMs) stats.maxMs = elapsed;
+    switch (code){
+        case 1: increment(&stats.ok); break;
+        case 2: increment(&stats.error); break;
+        case 3: increment(&stats.cmeError); break;
+        case 4: increment(&stats.cmsError); break;
+    }
+}
+
+void ModemStats::timeout()
+{
+    if (_pending < 0) return;
+    increment(&_commands[_pending].timeouts);
+    _pending = -1;
+}
+
+void ModemStats::received(uint8_t mux, uint16_t stored, uint16_t dropped)
+{
+    if (mux >= MODEM_STATS_SOCKETS) return;
+    _sockets[mux].bytesIn += stored;
+    if (dropped > 0){
+        _sockets[mux].droppedBytes += dropped;
+        increment(&_sockets[mux].overflows);
+    }
+}
+
+void ModemStats::sent(uint8_t mux, uint16_t len)
+{
+    if (mux < MODEM_STATS_SOCKETS) _sockets[mux].bytesOut += len;
+}
+
+void ModemStats::dump(Print& out) const
+{
+    out.println(F("command     ok  err  cme  cms  t/o   max ms |  <10  <20  <50 <100 <200 <500  <1s  <2s  <5s <10s <30s >30s"));
+    for (uint8_t i = 0; i < MODEM_CMD_COUNT; i++){
+        const ModemCommandStats& stats = _commands[i];
+        if (stats.ok + stats.error + stats.cmeError + stats.cmsError + stats.timeouts == 0) continue;
+        out.print(COMMAND_NAMES[i]);
+        for (uint8_t pad = strlen(COMMAND_NAMES[i]); pad < 8; pad++) out.print(' ');
+        printColumn(out, stats.ok, 5);
+        printColumn(out, stats.error, 5);
+        printColumn(out, stats.cmeError, 5);
+        printColumn(out, stats.cmsError, 5);
+        printColumn(out, stats.timeouts, 5);
+        printColumn(out, stats.maxMs, 9);
+        out.print(F(" |"));
+        for (uint8_t b = 0; b < MODEM_STATS_BUCKETS; b++){
+            printColumn(out, stats.buckets[b], 5);
+        }
+        out.println();
+    }
+    for (uint8_t mux = 0; mux < MODEM_STATS_SOCKETS; mux++){
+        const ModemSocketStats& stats = _sockets[mux];
+        if (stats.bytesIn + stats.bytesOut == 0) continue;
+        out.print(F("socket "));
+        out.print(mux);
+        out.print(F(": in "));
+        out.print(stats.bytesIn);
+        out.print(F(" B, out "));
+        out.print(stats.bytesOut);
+        out.print(F(" B, "));
+        out.print(stats.overflows);
+        out.print(F(" overflows ("));
+        out.print(stats.droppedBytes);
+        out.println(F(" B dropped)"));
+    }
+}
+
+uint16_t ModemStats::serialize(uint8_t* out, uint16_t size) const
+{
+    uint16_t pos = 0;
+    uint8_t used = 0;
+    for (uint8_t i = 0; i < MODEM_CMD_COUNT; i++){
+        const ModemCommandStats& stats = _commands[i];
+        if (stats.ok + stats.error + stats.cmeError + stats.cmsError + stats.timeouts != 0) used++;
+    }
+    bool ok = putVarint(out, size, &pos, MODEM_STATS_VERSION) && putVarint(out, size, &pos, used);
+    for (uint8_t i = 0; ok && i < MODEM_CMD_COUNT; i++){
+        const ModemCommandStats& stats = _commands[i];
+        if (stats.ok + stats.error + stats.cmeError + stats.cmsError + stats.timeouts == 0) continue;
+        //only the non empty buckets, flagged in a bit mask
+        uint16_t mask = 0;
+        for (uint8_t b = 0; b < MODEM_STATS_BUCKETS; b++){
+            if (stats.buckets[b] != 0) mask |= 1 << b;
+        }
+        ok = putVarint(out, size, &pos, i) && putVarint(out, size, &pos, mask);
+        for (uint8_t b = 0; ok && b < MODEM_STATS_BUCKETS; b++){
+            if (stats.buckets[b] != 0) ok = putVarint(out, size, &pos, stats.buckets[b]);
+        }
+        ok = ok && putVarint(out, size, &pos, stats.ok) && putVarint(out, size, &pos, stats.error)
+            && putVarint(out, size, &pos, stats.cmeError) && putVarint(out, size, &pos, stats.cmsError)
+            && putVarint(out, size, &pos, stats.timeouts) && putVarint(out, size, &pos, stats.maxMs);
+    }
+    ok = ok && putVarint(out, size, &pos, MODEM_STATS_SOCKETS);
+    for (uint8_t mux = 0; ok && mux < MODEM_STATS_SOCKETS; mux++){
+        const ModemSocketStats& stats = _sockets[mux];
+        ok = putVarint(out, size, &pos, stats.bytesIn) && putVarint(out, size, &pos, stats.bytesOut)
+            && putVarint(out, size, &pos, stats.droppedBytes) && putVarint(out, size, &pos, stats.overflows);
+    }
+    return ok ? pos : 0;
+}
@@ -0,0 +1,75 @@
+#include "ModemUrc.h"
+
+#include <string.h>
+
+struct ModemUrcEntry {
+    const char* prefix;
+    uint8_t len;
+    bool unsolicited;
+};
+
+#define MODEM_URC_ENTRY(name, prefix, unsolicited) {prefix, sizeof(prefix) - 1, unsolicited},
+static constexpr ModemUrcEntry URC_TABLE[] = {
+    MODEM_URC_LIST(MODEM_URC_ENTRY)
+};
+#undef MODEM_URC_ENTRY
+
+static constexpr bool tableSorted(const ModemUrcEntry* table, uint8_t count)
+{
+    return count < 2 || (modemPrefixLess(table[0].prefix, table[1].prefix) && tableSorted(table + 1, count - 1));
+}
+
+static_assert(sizeof(URC_TABLE) / sizeof(URC_TABLE[0]) == MODEM_URC_COUNT, "URC table and enum out of sync");
+static_assert(tableSorted(URC_TABLE, MODEM_URC_COUNT), "MODEM_URC_LIST must be sorted by prefix");
+
+static bool isWordChar(char c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
+}
+
+//3-way compare of a line with a prefix, 0 on match
+static int compare(const char* line, uint16_t len, const ModemUrcEntry& entry)
+{
+    int c = memcmp(line, entry.prefix, len < entry.len ? len : entry.len);
+    if (c != 0) return c;
+    if (len < entry.len) return -1;
+    if (len == entry.len || !isWordChar(entry.prefix[entry.len - 1]) || !isWordChar(line[entry.len])) return 0;
+    return 1; //longer word, e.g. "+CMTI" against "+CMT"
+}
+
+ModemUrc modemUrcLookup(const char* line, uint16_t len)
+{
+    if (len >= 3 && line[0] >= '0' && line[0] <= '9' && line[1] == ',' && line[2] == ' '){
+        return MODEM_URC_SOCKET;
+    }
+    uint8_t low = 0;
+    uint8_t high = MODEM_URC_COUNT;
+    while (low < high){
+        uint8_t mid = (low + high) / 2;
+        int c = compare(line, len, URC_TABLE[mid]);
+        if (c == 0) return static_cast<ModemUrc>(mid);
+        if (c < 0) high = mid;
+        else low = mid + 1;
+    }
+    return MODEM_URC_UNKNOWN;
+}
+
+bool modemUrcUnsolicited(ModemUrc urc)
+{
+    return urc < MODEM_URC_COUNT && URC_TABLE[urc].unsolicited;
+}
+
+bool modemUrcUnsolicited(ModemUrc urc, const char* line, uint16_t len)
+{
+    if (urc == MODEM_URC_CREG || urc == MODEM_URC_CGREG){
+        //the second parameter is the quoted LAC in a report, the status in a response
+        const char* comma = static_cast<const char*>(memchr(line, ',', len));
+        return comma == NULL || (comma + 1 < line + len && comma[1] == '"');
+    }
+    return modemUrcUnsolicited(urc);
+}
+
+const char* modemUrcPrefix(ModemUrc urc)
+{
+    return urc < MODEM_URC_COUNT ? URC_TABLE[urc].prefix : "";
+}
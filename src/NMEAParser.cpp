@@ -0,0 +1,248 @@
+#include "NMEAParser.h"
+
+#include <string.h>
+
+#include "CivilTime.h"
+
+static int8_t hexDigit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+//"123.4567" -> 1234567 with decimals = 4 (extra digits truncated, missing ones padded)
+static int32_t parseFixed(const char* s, uint8_t decimals)
+{
+    bool negative = *s == '-';
+    if (negative) s++;
+    int32_t value = 0;
+    while (*s >= '0' && *s <= '9'){
+        value = value * 10 + (*s++ - '0');
+    }
+    if (*s == '.') s++;
+    for (uint8_t i = 0; i < decimals; i++){
+        value *= 10;
+        if (*s >= '0' && *s <= '9'){
+            value += *s++ - '0';
+        }
+    }
+    return negative ? -value : value;
+}
+
+//"ddmm.mmmm" or "dddmm.mmmm" -> degrees * 1e6
+static int32_t parseCoordinate(const char* s)
+{
+    int32_t degrees = 0;
+    const char* dot = strchr(s, '.');
+    uint8_t intDigits = dot ? dot - s : strlen(s);
+    if (intDigits < 3) return 0;
+    for (uint8_t i = 0; i < intDigits - 2; i++){
+        degrees = degrees * 10 + (s[i] - '0');
+    }
+    int32_t minutes = parseFixed(s + intDigits - 2, 6); //minutes * 1e6
+    return degrees * 1000000L + (minutes + 30) / 60;
+}
+
+NMEAParser::NMEAParser():
+    _state(NMEA_IDLE),
+    _sentence(SENTENCE_OTHER),
+    _fieldLen(0),
+    _fieldIndex(0),
+    _checksum(0),
+    _received(0),
+    _checksumDigits(0),
+    _overflow(false),
+    _positionInSentence(false),
+    _updated(false),
+    _updatedTime(0xFFFFFFFF),
+    _sentences(0),
+    _checksumErrors(0)
+{
+    memset(&_fix, 0, sizeof(_fix));
+    _pending = _fix;
+}
+
+bool NMEAParser::feed(const char* data, uint16_t len)
+{
+    bool updated = false;
+    for (uint16_t i = 0; i < len; i++){
+        updated |= feed(data[i]);
+    }
+    return updated;
+}
+
+bool NMEAParser::feed(char c)
+{
+    if (c == '$'){
+        //start of sentence, also recovers from a truncated one
+        _state = NMEA_BODY;
+        _sentence = SENTENCE_OTHER;
+        _fieldLen = 0;
+        _fieldIndex = 0;
+        _checksum = 0;
+        _overflow = false;
+        _positionInSentence = false;
+        _pending = _fix;
+        return false;
+    }
+
+    switch (_state){
+        case NMEA_IDLE:
+        default:
+            return false;
+
+        case NMEA_BODY:{
+            if (c == '*'){
+                endField();
+                _state = NMEA_CHECKSUM;
+                _received = 0;
+                _checksumDigits = 0;
+            }
+            else if (c == '\r' || c == '\n'){
+                _state = NMEA_IDLE; //checksum is mandatory
+                _checksumErrors++;
+            }
+            else{
+                _checksum ^= c;
+                if (c == ','){
+                    endField();
+                }
+                else if (_fieldLen < NMEA_FIELD_MAX){
+                    _field[_fieldLen++] = c;
+                }
+                else{
+                    _overflow = true;
+                }
+            }
+            return false;
+        }
+
+        case NMEA_CHECKSUM:{
+            int8_t digit = hexDigit(c);
+            if (digit < 0){
+                _state = NMEA_IDLE;
+                _checksumErrors++;
+                return false;
+            }
+            _received = (_received << 4) | digit;
+            if (++_checksumDigits < 2) return false;
+            _state = NMEA_IDLE;
+            return endSentence();
+        }
+    }
+}
+
+bool NMEAParser::endSentence()
+{
+    if (_received != _checksum || _overflow){
+        _checksumErrors++;
+        return false;
+    }
+    _sentences++;
+    if (_sentence == SENTENCE_OTHER) return false;
+    _fix = _pending;
+    if (_positionInSentence && _fix.valid && _fix.time != _updatedTime){
+        _updated = true;
+        _updatedTime = _fix.time;
+    }
+    return true;
+}
+
+void NMEAParser::endField()
+{
+    _field[_fieldLen] = '\0';
+    const char* f = _field;
+    bool empty = _fieldLen == 0;
+    uint8_t index = _fieldIndex++;
+    _fieldLen = 0;
+
+    if (index == 0){
+        //talker (2 chars) + sentence type
+        uint8_t len = strlen(f);
+        const char* type = len >= 5 ? f + len - 3 : "";
+        if (!strcmp(type, "GGA")) _sentence = SENTENCE_GGA;
+        else if (!strcmp(type, "RMC")) _sentence = SENTENCE_RMC;
+        else if (!strcmp(type, "GSA")) _sentence = SENTENCE_GSA;
+        else if (!strcmp(type, "VTG")) _sentence = SENTENCE_VTG;
+        return;
+    }
+
+    switch (_sentence){
+        case SENTENCE_GGA:{
+            switch (index){
+                case 1: if (!empty) _pending.time = parseFixed(f, 0); break;
+                case 2: _pending.latitude = parseCoordinate(f); break;
+                case 3: if (*f == 'S') _pending.latitude = -_pending.latitude; break;
+                case 4: _pending.longitude = parseCoordinate(f); break;
+                case 5: if (*f == 'W') _pending.longitude = -_pending.longitude; break;
+                case 6:
+                    _pending.quality = parseFixed(f, 0);
+                    _pending.valid = _pending.quality != 0;
+                    _positionInSentence = true;
+                    break;
+                case 7: _pending.satellites = parseFixed(f, 0); break;
+                case 8: if (!empty) _pending.hdop = parseFixed(f, 2); break;
+                case 9: if (!empty) _pending.altitude = parseFixed(f, 1); break;
+            }
+            break;
+        }
+        case SENTENCE_RMC:{
+            switch (index){
+                case 1: if (!empty) _pending.time = parseFixed(f, 0); break;
+                case 2:
+                    _pending.valid = *f == 'A';
+                    _positionInSentence = true;
+                    break;
+                case 3: _pending.latitude = parseCoordinate(f); break;
+                case 4: if (*f == 'S') _pending.latitude = -_pending.latitude; break;
+                case 5: _pending.longitude = parseCoordinate(f); break;
+                case 6: if (*f == 'W') _pending.longitude = -_pending.longitude; break;
+                case 7: if (!empty) _pending.speed = parseFixed(f, 2) * 1852L / 1000; break; //knots -> km/h
+                case 8: if (!empty) _pending.course = parseFixed(f, 2); break;
+                case 9: if (!empty) _pending.date = parseFixed(f, 0); break;
+            }
+            break;
+        }
+        case SENTENCE_GSA:{
+            switch (index){
+                case 2: _pending.fixType = parseFixed(f, 0); break;
+                case 15: if (!empty) _pending.pdop = parseFixed(f, 2); break;
+                case 16: if (!empty) _pending.hdop = parseFixed(f, 2); break;
+                case 17: if (!empty) _pending.vdop = parseFixed(f, 2); break;
+            }
+            break;
+        }
+        case SENTENCE_VTG:{
+            switch (index){
+                case 1: if (!empty) _pending.course = parseFixed(f, 2); break;
+                case 7: if (!empty) _pending.speed = parseFixed(f, 2); break;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+bool NMEAParser::updated()
+{
+    bool updated = _updated;
+    _updated = false;
+    return updated;
+}
+
+uint16_t NMEAParser::accuracy() const
+{
+    return (static_cast<uint32_t>(_fix.hdop) * NMEA_UERE_CM + 5000) / 10000;
+}
+
+uint32_t NMEAParser::epoch() const
+{
+    if (_fix.date == 0) return 0;
+    uint8_t day = _fix.date / 10000;
+    uint8_t month = (_fix.date / 100) % 100;
+    uint16_t year = 2000 + _fix.date % 100;
+    return civilToEpoch(year, month, day, _fix.time / 10000, (_fix.time / 100) % 100, _fix.time % 100);
+}
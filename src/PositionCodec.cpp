@@ -0,0 +1,81 @@
+#include "PositionCodec.h"
+
+#include <string.h>
+
+#include "Varint.h"
+
+//differences are taken modulo 2^32, so any pair of values round-trips
+static inline uint32_t delta(uint32_t value, uint32_t previous)
+{
+    return zigzag(static_cast<int32_t>(value - previous));
+}
+
+PositionEncoder::PositionEncoder(uint8_t* out, uint16_t size):
+    _out(out),
+    _size(size),
+    _length(POSITION_CODEC_HEADER_SIZE),
+    _count(0)
+{
+    memset(&_last, 0, sizeof(_last));
+}
+
+bool PositionEncoder::add(const PositionFix& fix)
+{
+    if (_count == POSITION_CODEC_MAX_FIXES) return false;
+
+    //the base record is a delta from an all-zero fix
+    uint8_t record[POSITION_CODEC_RECORD_MAX];
+    uint16_t recordLen = 0;
+    putVarint(record, sizeof(record), &recordLen, delta(fix.latitude, _last.latitude));
+    putVarint(record, sizeof(record), &recordLen, delta(fix.longitude, _last.longitude));
+    putVarint(record, sizeof(record), &recordLen, delta(fix.altitude, _last.altitude));
+    putVarint(record, sizeof(record), &recordLen, delta(fix.accuracy, _last.accuracy));
+    putVarint(record, sizeof(record), &recordLen, delta(fix.timestamp, _last.timestamp));
+
+    if (_length + recordLen > _size) return false;
+    memcpy(_out + _length, record, recordLen);
+    _length += recordLen;
+    _last = fix;
+    _count++;
+    _out[0] = POSITION_CODEC_FORMAT;
+    _out[1] = _count;
+    return true;
+}
+
+PositionDecoder::PositionDecoder(const uint8_t* data, uint16_t len):
+    _data(data),
+    _len(len),
+    _pos(POSITION_CODEC_HEADER_SIZE),
+    _count(0),
+    _decoded(0),
+    _error(false)
+{
+    memset(&_last, 0, sizeof(_last));
+    if (len < POSITION_CODEC_HEADER_SIZE || data[0] != POSITION_CODEC_FORMAT){
+        _error = true;
+    }
+    else{
+        _count = data[1];
+    }
+}
+
+bool PositionDecoder::next(PositionFix* fix)
+{
+    if (_error || _decoded == _count) return false;
+
+    uint32_t d[5];
+    for (uint8_t i = 0; i < 5; i++){
+        if (!getVarint(_data, _len, &_pos, &d[i])){
+            _error = true;
+            return false;
+        }
+    }
+    _last.latitude = static_cast<int32_t>(_last.latitude + static_cast<uint32_t>(unzigzag(d[0])));
+    _last.longitude = static_cast<int32_t>(_last.longitude + static_cast<uint32_t>(unzigzag(d[1])));
+    _last.altitude = static_cast<int32_t>(_last.altitude + static_cast<uint32_t>(unzigzag(d[2])));
+    _last.accuracy = static_cast<uint16_t>(_last.accuracy + unzigzag(d[3]));
+    _last.timestamp = _last.timestamp + static_cast<uint32_t>(unzigzag(d[4]));
+    _decoded++;
+    *fix = _last;
+    return true;
+}
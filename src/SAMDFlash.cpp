@@ -0,0 +1,60 @@
+#include "SAMDFlash.h"
+
+#if defined(ARDUINO_ARCH_SAMD)
+
+SAMDFlash::SAMDFlash(const void* region, uint32_t size):
+    _region((volatile uint8_t*) region),
+    _size(size),
+    _pageSize(8 << NVMCTRL->PARAM.bit.PSZ)
+{
+}
+
+void SAMDFlash::command(uint32_t cmd)
+{
+    NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | cmd;
+    while (!NVMCTRL->INTFLAG.bit.READY) { }
+}
+
+void SAMDFlash::read(uint32_t address, void* data, uint16_t len)
+{
+    uint8_t* out = (uint8_t*) data;
+    for (uint16_t i = 0; i < len; i++){
+        out[i] = _region[address + i];
+    }
+}
+
+bool SAMDFlash::write(uint32_t address, const void* data, uint16_t len)
+{
+    if (address % 4 != 0 || address / _pageSize != (address + len - 1) / _pageSize) return false;
+
+    //page buffer is written with 32 bit accesses, bytes past len are left erased
+    NVMCTRL->CTRLB.bit.MANW = 1;
+    command(NVMCTRL_CTRLA_CMD_PBC);
+    NVMCTRL->STATUS.reg |= NVMCTRL_STATUS_MASK;
+
+    const uint8_t* in = (const uint8_t*) data;
+    volatile uint32_t* dst = (volatile uint32_t*) (_region + address);
+    for (uint16_t i = 0; i < len; i += 4){
+        uint32_t word = 0xFFFFFFFF;
+        memcpy(&word, in + i, min(len - i, 4));
+        *dst++ = word;
+    }
+    command(NVMCTRL_CTRLA_CMD_WP);
+
+    for (uint16_t i = 0; i < len; i++){
+        if (_region[address + i] != in[i]) return false;
+    }
+    return true;
+}
+
+bool SAMDFlash::erase(uint32_t address)
+{
+    address -= address % rowSize();
+    NVMCTRL->STATUS.reg |= NVMCTRL_STATUS_MASK;
+    //ADDR takes a 16 bit word address
+    NVMCTRL->ADDR.reg = ((uint32_t) (_region + address)) / 2;
+    command(NVMCTRL_CTRLA_CMD_ER);
+    return !NVMCTRL->STATUS.bit.LOCKE && !NVMCTRL->STATUS.bit.PROGE;
+}
+
+#endif
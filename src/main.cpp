@@ -2,6 +2,8 @@
 #define TINY_GSM_DEBUG SerialUSB
 #include <TinyGSM.h>
 
+#include "MemoryStats.h"
+
 #define GSM_PWR_PIN 9
 #define GSM_RST_PIN 6
 #define GSM_LOW_PWR_PIN 5
@@ -9,6 +11,7 @@
 
 void setup() {
     // put your setup code here, to run once:
+    MEMORY_STATS.paintStack(); //before anything else uses the stack
 
     pinMode(GSM_PWR_PIN, OUTPUT);
     pinMode(GSM_RST_PIN, OUTPUT);
@@ -57,6 +60,7 @@ void loop() {
     else{
         SerialUSB.println("Failed to connecto via TCP!");
     }
+    MEMORY_STATS.dump(SerialUSB);
     
     while (true){
         while (Serial1.available() > 0) {
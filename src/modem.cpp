@@ -1,5 +1,6 @@
 #include "modem.h"
 #include "socket.h"
+#include "Crc16.h"
 
 ModemClass::ModemClass(Uart& uart, unsigned long baud):
     _uart(&uart),
@@ -7,14 +8,30 @@ ModemClass::ModemClass(Uart& uart, unsigned long baud):
     _lowPowerMode(false),
     _lastResponseOrUrcMillis(0),
     _init(false),
+    _initSocks(0),
+    _urcState(URC_IDLE),
+    _atCommandState(AT_IDLE),
     _ready(1),
-	_sent(false),
+    _sent(false),
+    _bufferLen(0),
+    _lineStart(0),
+    _echo(true),
+    _sendPending(NULL),
+    _sendPendingLen(0),
+    _queueHead(0),
+    _queueCount(0),
+    _queueActive(false),
+    _queueStart(0),
+    _queueSavedReady(1),
     _responseDataStorage(NULL),
-    _initSocks(0),
-    _atCommandState(AT_IDLE)
+    _responseSlot(0),
+    _capture(NULL),
+    _connectInFlight(false),
+    _earlyConnect(0),
+    _earlyConnectMux(-1)
 
 {
-    _buffer.reserve(64); //reserve 64 chars
+    _buffer[0] = '\0';
 }
 
 
@@ -35,15 +52,24 @@ ModemClass::ModemClass(Uart& uart, unsigned long baud):
 
 */
 
+static const unsigned long BAUD_RATES[] = {MODEM_BAUD_RATES};
+#define BAUD_RATE_COUNT (sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]))
+
 bool ModemClass::init()
 {
     if(!_init){
-        _uart->begin(_baud > 115200 ? 115200 : _baud);
-
-        send(F("ATV1")); //set verbose mode
-        if(waitForResponse() != 1) return false;
-
-        if (!autosense()){
+        _echo = true; //modem default after power on
+
+        //the modem boots at the rate saved in its profile: the configured one first, then the others
+        unsigned long baud = _baud;
+        bool awake = wakeAt(baud, 10000);
+        for (uint8_t i = 0; !awake && i < BAUD_RATE_COUNT; i++){
+            if (BAUD_RATES[i] != _baud){
+                baud = BAUD_RATES[i];
+                awake = wakeAt(baud, MODEM_BAUD_SENSE_MS);
+            }
+        }
+        if (!awake){
             return false;
         }
 
@@ -57,22 +83,146 @@ bool ModemClass::init()
         send(F("AT+CIPSPRT=0")); //turn off TCP prompt ">" 
         waitForResponse();
         
-        //check if baud can be set higher than default 115200
-
-        if (_baud > 115200){
-            sendf("AT+IPR=%ld", _baud);
-            if (waitForResponse() != 1){
+        //found below the configured rate: move it up. A faster rate is the one saved by
+        //negotiateBaudRate() on an earlier boot, and is kept
+        if (baud < _baud){
+            unsigned long target = _baud;
+            _baud = baud;
+            if (!switchBaudRate(target)){
                 return false;
             }
+        }
+        else{
+            _baud = baud;
+        }
+        _init = true;
+    }
+    return true;
+}
+
+//verbose mode (ATV1 is answered in both modes), then the modem must answer an AT at baud
+bool ModemClass::wakeAt(unsigned long baud, unsigned int timeout)
+{
+    _uart->end();
+    _uart->begin(baud);
+    send(F("ATV1"));
+    if(waitForResponse() != 1) return false;
+    return autosense(timeout);
+}
+
+//AT+IPR, then the uart follows; false if the modem does not answer at the new rate
+bool ModemClass::switchBaudRate(unsigned long baud)
+{
+    send("AT+IPR=", baud);
+    //on a bad link the OK can be garbled while the modem switches anyway: what counts is the answer at the new rate
+    waitForResponse();
+    _uart->end();
+    delay(100);
+    _uart->begin(baud);
+    if (!autosense(MODEM_BAUD_SENSE_MS)){
+        return false;
+    }
+    _baud = baud;
+    return true;
+}
+
+unsigned long ModemClass::negotiateBaudRate(unsigned long maxBaud)
+{
+    bool echo = _echo;
+    if (!echo && !turnEcho(true)){
+        return 0;
+    }
+    unsigned long good = _baud;
+    for (uint8_t i = 0; i < BAUD_RATE_COUNT && BAUD_RATES[i] <= maxBaud; i++){
+        unsigned long baud = BAUD_RATES[i];
+        if (baud <= good) continue;
+        if (switchBaudRate(baud) && probeEcho()){
+            DBG("#DEBUG# baud rate ", baud, " ok");
+            good = baud;
+            continue;
+        }
+        DBG("#DEBUG# errors at baud rate ", baud, ", back to ", good);
+        //the modem may be at baud (garbled link) or still at good (AT+IPR not understood)
+        bool back = false;
+        for (uint8_t attempt = 0; !back && attempt < MODEM_BAUD_RETRIES; attempt++){
             _uart->end();
-            delay(100);
-            _uart->begin(_baud);
+            _uart->begin(baud);
+            back = switchBaudRate(good);
+        }
+        if (!back){
+            return 0;
+        }
+        break;
+    }
+    //saved with echo on, the mode init() expects after power on
+    send(F("AT&W")); //boot at this rate from now on
+    waitForResponse();
+    if (!echo){
+        turnEcho(false);
+    }
+    return _baud;
+}
 
-            if (!autosense()){
-                return false;
+//MODEM_BAUD_PROBE_LINES rounds of AT+XPROBE="<payload>": the modem echoes the line back, then
+//rejects the unknown command. The payload must come back with the same CRC, followed by a result code.
+bool ModemClass::probeEcho()
+{
+    uint32_t seed = _baud;
+    for (uint8_t line = 0; line < MODEM_BAUD_PROBE_LINES; line++){
+        unsigned long delta = millis() - _lastResponseOrUrcMillis;
+        if (delta < MODEM_MIN_RESPONSE_OR_URC_WAIT_TIME_MS){
+            delay(MODEM_MIN_RESPONSE_OR_URC_WAIT_TIME_MS - delta);
+        }
+
+        //printable payload without '"' and '\\', walking all the bit patterns the line carries
+        char payload[MODEM_BAUD_PROBE_SIZE];
+        uint16_t crc = 0xFFFF;
+        for (uint8_t i = 0; i < MODEM_BAUD_PROBE_SIZE; i++){
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            char c = '#' + seed % ('~' - '#' + 1);
+            payload[i] = c == '\\' ? '!' : c;
+            crc = crc16(crc, payload[i]);
+        }
+        put("AT+XPROBE=\"");
+        write((const uint8_t*) payload, sizeof(payload));
+        put('"');
+        endSend();
+
+        //raw read, the line parser is not involved: echo between the quotes, then a result line
+        uint16_t echoed = 0xFFFF;
+        uint16_t echoedLen = 0;
+        uint8_t quotes = 0;
+        char result[12];
+        uint8_t resultLen = 0;
+        bool done = false;
+        for (unsigned long start = millis(); !done && millis() - start < MODEM_BAUD_PROBE_TIMEOUT_MS;){
+            if (_uart->available() <= 0) continue;
+            char c = readUart();
+            if (c == '"'){
+                quotes++;
+            }
+            else if (quotes == 1){
+                echoed = crc16(echoed, c);
+                echoedLen++;
+            }
+            else if (quotes >= 2){
+                if (c == '\n'){
+                    result[resultLen] = '\0';
+                    done = !strncmp(result, "OK", 2) || !strncmp(result, "ERROR", 5) || !strncmp(result, "+CME ERROR", 10);
+                    resultLen = 0;
+                }
+                else if (c != '\r' && resultLen < sizeof(result) - 1){
+                    result[resultLen++] = c;
+                }
             }
         }
-        _init = true;
+        _lastResponseOrUrcMillis = millis();
+        if (!done || quotes != 2 || echoedLen != MODEM_BAUD_PROBE_SIZE || echoed != crc){
+            DBG("#DEBUG# echo line ", line, " corrupted at baud rate ", _baud);
+            return false;
+        }
     }
     return true;
 }
@@ -84,7 +234,7 @@ bool ModemClass::restart()
         return (waitForResponse(1000) == 1);
     }
     else{
-        init();
+        return init();
     }
 }
 
@@ -100,6 +250,7 @@ bool ModemClass::powerOff()
         _init = false;
         send(F("AT+CPOF"));
         uint8_t stat = waitForResponse();
+        _echo = true;
         _uart->end();
         return stat == 1;
     }
@@ -137,12 +288,13 @@ void ModemClass::noLowPowerMode()
 
 bool ModemClass::turnEcho(bool on)
 {
-    sendf("ATE%d", on? 1:0);
+    send("ATE", on);
     uint8_t resp = waitForResponse();
     if (resp != 1){
         DBG("#DEBUG# setting echo mode failed!");
         return false;
     }
+    _echo = on;
     return true;
 }
 
@@ -150,13 +302,19 @@ uint16_t ModemClass::write(uint8_t c)
 {
     //make sure to turn off echo, because this is not intended to be used as a send method!
     //so we don't want the modem to echo back c
-   return _uart->write(c);
+    if (_capture != NULL){
+        _capture->record(MODEM_CAPTURE_TX, c);
+    }
+    return _uart->write(c);
 }
 
 uint16_t ModemClass::write(const uint8_t* buf, uint16_t size)
 {
     //make sure to turn off echo, because this is not intended to be used as a send method!
     //so we don't want the modem to echo back the content of buffer
+    if (_capture != NULL){
+        _capture->record(MODEM_CAPTURE_TX, buf, size);
+    }
     return _uart->write(buf, size);
 }
 
@@ -176,26 +334,28 @@ void ModemClass::send(const char* command)
     command, then at least the 20ms pause time shall be respected.
     */
 
-    if (_lowPowerMode){
-        digitalWrite(GSM_LOW_PWR_PIN, HIGH); //turn off low power mode if on
-        delay(5);
-    }
-
-    unsigned long delta = millis() - _lastResponseOrUrcMillis;
-    if(delta < MODEM_MIN_RESPONSE_OR_URC_WAIT_TIME_MS){
-        delay(MODEM_MIN_RESPONSE_OR_URC_WAIT_TIME_MS - delta);
-    }
-
+    beginSend(command);
+    put(command);
+    endSend();
+}
 
-    _ready = 0;
-	_sent = true;
-    _atCommandState = AT_IDLE;
-    _uart->println(command);
-    _uart->flush();
+void ModemClass::send(const __FlashStringHelper* command)
+{
+    beginSend(reinterpret_cast<const char*>(command));
+    put(command);
+    endSend();
 }
 
-void ModemClass::send(__FlashStringHelper* command)
+void ModemClass::beginSend(const char* command)
 {
+    //let a queued command in flight complete (or time out) first
+    while (_queueActive){
+        poll();
+    }
+
+    //a pipelined CIPSEND may still be waiting for its result: collect it first
+    collectSend();
+
     if (_lowPowerMode){
         digitalWrite(GSM_LOW_PWR_PIN, HIGH); //turn off low power mode if on
         delay(5);
@@ -208,27 +368,66 @@ void ModemClass::send(__FlashStringHelper* command)
         delay(MODEM_MIN_RESPONSE_OR_URC_WAIT_TIME_MS - delta);
     }
 
+    MODEM_STATS(start(command));
+    (void) command; //only read by the stats
     _ready = 0;
-	_sent = true;
-    _atCommandState = AT_IDLE;
-    _uart->println(command);
+    //with echo off the response starts right away, there is no command echo to wait for
+	_sent = _echo;
+    _atCommandState = _echo ? AT_IDLE : AT_RECV_RESP;
+}
+
+//result of a pipelined CIPSEND, a failure is counted on its socket
+void ModemClass::collectSend()
+{
+    GSM_Socket* socket = _sendPending;
+    if (socket == NULL) return;
+    _sendPending = NULL;
+    if (waitForResponse(MODEM_SEND_TIMEOUT_MS) != 1){
+        DBG("#DEBUG# pipelined send failed on socket ", socket->_mux);
+        socket->_failedSends++;
+        return;
+    }
+    MODEM_STATS(sent(socket->_mux, _sendPendingLen));
+}
+
+void ModemClass::endSend()
+{
+    put("\r\n");
     _uart->flush();
 }
 
-void ModemClass::sendf(const char *fmt, ...)
+void ModemClass::put(const ModemQuoted& quoted)
 {
-    char buf[BUFSIZ];
-    va_list ap;
-    va_start((ap), (fmt));
-    vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
-    va_end(ap);
-    send(buf);
+    put('"');
+    put(quoted.str);
+    put('"');
+}
+
+void ModemClass::put(const ModemPadded& padded)
+{
+    char sign = padded.value < 0 ? '-' : (padded.sign ? '+' : 0);
+    putNumber(padded.value < 0 ? 0UL - (unsigned long) padded.value : padded.value, padded.width, sign);
+}
+
+//decimal digits, at least width of them, after sign if not 0
+void ModemClass::putNumber(unsigned long value, uint8_t width, char sign)
+{
+    char digits[12];
+    uint8_t len = 0;
+    do {
+        digits[sizeof(digits) - ++len] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0 || len < min(width, (uint8_t) sizeof(digits)));
+    if (sign != 0){
+        put(sign);
+    }
+    write((const uint8_t*) digits + sizeof(digits) - len, len);
 }
 
 //call this only after send!
-int ModemClass::waitForResponse(unsigned long timeout, String* responseDataStorage)
+int ModemClass::waitForResponse(unsigned long timeout, ModemResponse* response)
 {
-    _responseDataStorage = responseDataStorage;
+    keepResponse(response, 0);
     unsigned long start = millis();
     while ((millis() - start) < timeout){
         uint8_t r = ready();
@@ -236,12 +435,102 @@ int ModemClass::waitForResponse(unsigned long timeout, String* responseDataStora
     }
     //clean up in case timeout occured
     DBG("#DEBUG# response timeout!");
+    MODEM_STATS(timeout());
+    resetResponse();
+    return -1;
+}
+
+void ModemClass::keepResponse(ModemResponse* dest, uint8_t slot)
+{
+    _responseDataStorage = dest;
+    _responseSlot = slot;
+    if (dest != NULL){
+        *dest = ModemResponse();
+    }
+}
+
+void ModemClass::resetResponse()
+{
     _responseDataStorage = NULL;
     _ready = 1;
     _atCommandState = AT_IDLE;
 	_sent = false;
-    _buffer = ""; //clean buffer in case we got some bytes but didn't complete in time
-    return -1;
+    clearBuffer(); //clean buffer in case we got some bytes but didn't complete in time
+}
+
+bool ModemClass::enqueue(const char* command, unsigned long timeout, ModemCallback callback, void* context)
+{
+    return enqueue(command, timeout, callback, context, NULL);
+}
+
+bool ModemClass::enqueue(const char* command, unsigned long timeout, ModemFuture* future)
+{
+    return enqueue(command, timeout, NULL, NULL, future);
+}
+
+bool ModemClass::enqueue(const char* command, unsigned long timeout, ModemCallback callback, void* context, ModemFuture* future)
+{
+    size_t len = strlen(command);
+    if (_queueCount == MODEM_QUEUE_SIZE || len >= MODEM_QUEUE_COMMAND_SIZE){
+        return false;
+    }
+    QueuedCommand& entry = _queue[(_queueHead + _queueCount) % MODEM_QUEUE_SIZE];
+    memcpy(entry.command, command, len + 1);
+    entry.timeout = timeout;
+    entry.callback = callback;
+    entry.context = context;
+    entry.future = future;
+    if (future != NULL){
+        future->result = 0;
+        future->response = ModemResponse();
+    }
+    _queueCount++;
+    return true;
+}
+
+//moves the command queue forward, called at the end of every poll()
+void ModemClass::processQueue()
+{
+    if (_queueActive){
+        QueuedCommand& entry = _queue[_queueHead];
+        int result = _ready;
+        if (result == 0){
+            if (millis() - _queueStart < entry.timeout) return;
+            DBG("#DEBUG# queued command timeout!");
+            MODEM_STATS(timeout());
+            resetResponse();
+            result = -1;
+        }
+        //the slot can be reused by the callback: take what we need first
+        ModemCallback callback = entry.callback;
+        void* context = entry.context;
+        ModemFuture* future = entry.future;
+        _queueActive = false;
+        _queueHead = (_queueHead + 1) % MODEM_QUEUE_SIZE;
+        _queueCount--;
+        _ready = _queueSavedReady; //callers polling ready() don't see the queued command
+        if (future != NULL){
+            future->result = result;
+        }
+        if (callback != NULL){
+            callback(result, future != NULL ? future->response : _queueResponse, context);
+        }
+        return;
+    }
+
+    //only issue when nothing else is in flight and the 20 ms gap has elapsed (never block here)
+    if (_queueCount == 0 || _ready == 0 || commandPending() || _sendPending != NULL || _urcState != URC_IDLE){
+        return;
+    }
+    if (millis() - _lastResponseOrUrcMillis < MODEM_MIN_RESPONSE_OR_URC_WAIT_TIME_MS){
+        return;
+    }
+    QueuedCommand& entry = _queue[_queueHead];
+    _queueSavedReady = _ready;
+    send(entry.command);
+    keepResponse(entry.future != NULL ? &entry.future->response : &_queueResponse, 1 + _queueHead);
+    _queueStart = millis();
+    _queueActive = true;
 }
 
 uint8_t ModemClass::ready()
@@ -250,139 +539,372 @@ uint8_t ModemClass::ready()
     return _ready;
 }
 
+//trims whitespace around [begin, end) in place and returns the NUL terminated result
+static char* trim(char* begin, char* end)
+{
+    while (begin < end && isspace((unsigned char) *begin)) begin++;
+    while (end > begin && isspace((unsigned char) *(end - 1))) end--;
+    *end = '\0';
+    return begin;
+}
+
+static uint16_t parseDecimal(const char** p)
+{
+    uint16_t value = 0;
+    while (**p >= '0' && **p <= '9'){
+        value = value * 10 + (*(*p)++ - '0');
+    }
+    return value;
+}
+
 void ModemClass::poll()
 {
-    //DBG("*** POLL");
-    while(_uart->available()){
-        char c = _uart->read();
-        _buffer += c;
-        //DBG("#DEBUG BUFFER#", _buffer);
-        //DBG("#DEBUG CHAR#", c);
+    //the parser works line by line on a fixed buffer: every byte costs O(1), result codes
+    //are checked only when a line terminates and URC prefixes only on their delimiter
+    int available;
+    while((available = _uart->available()) > 0){
+        if (_urcState == URC_RECV_SOCK_CHUNK){
+            //bulk mode: move the whole chunk (as much as the uart holds) straight into the socket
+            uint16_t len = min((uint16_t) min(available, 0xFFFF), _chunkLen);
+            if (_sock < MAX_SOCKETS){
+                _sockets[_sock]->receive(*this, len);
+            }
+            else{
+                for (uint16_t i = 0; i < len; i++) readUart();
+            }
+            _chunkLen -= len;
+            if(_chunkLen == 0){
+                //done receiving chunk, skip the line terminator that follows it
+                _urcState = URC_SKIP_CHUNK_END;
+            }
+            continue;
+        }
+
+        char c = readUart();
+        switch(_urcState){
+            case URC_SKIP_CHUNK_END:{
+                if (c == '\n'){
+                    _lastResponseOrUrcMillis = millis();
+                    _urcState = URC_IDLE;
+                    if (!commandPending()){
+                        _ready = _chunkSavedReady;
+                    }
+                }
+                continue;
+            }
+            case URC_IDLE:
+            default:
+                break;
+        }
+
+        bufferPut(c);
         switch(_atCommandState){
             default:
             case AT_IDLE:{
-                if (_sent && (_buffer.startsWith("AT") || _buffer.startsWith("\r\nAT"))
-                            && _buffer.endsWith("\r\n")){ //we use _sent check in case some URC contains the AT string!
+                if (c == '\n' && _sent && lineStartsWith("AT", 2)){ //we use _sent check in case some URC contains the AT string!
                     _atCommandState = AT_RECV_RESP;
-                    _buffer.trim();
-                    DBG("#DEBUG# command sent: \"", _buffer, "\"");
-                    _buffer = "";
+                    DBG("#DEBUG# command sent: \"", trim(_buffer + _lineStart, _buffer + _bufferLen), "\"");
+                    clearBuffer();
                     _sent = false;
-                    break;
                 }
-                else{
-                    switch(_urcState){
-                        default:
-                        case URC_IDLE:{
-                            checkUrc();
-                            break;
-                        }
-                        case URC_RECV_SOCK_CHUNK:{
-                            _buffer = "";
-                            //send to correct socket!
-                            _sockets[_sock]->handleUrc(&c, 1);
-                            if(--_chunkLen <= 0){
-                                //done receiving chunk
-                                _lastResponseOrUrcMillis = millis();
-                                _urcState = URC_IDLE;
-                                _ready = 1;
-                                bool skip = streamSkipUntil('\n');
-                                #ifdef GSM_DEBUG
-                                if (!skip){
-                                    DBG("#DEBUG# TCP missing END mark!");
-                                }
-                                #endif
-                            }
-                            break;
-                        }
-                    }
+                else if (c == '\n' || c == ':'){
+                    checkUrc();
                 }
                 break;
             }
             case AT_RECV_RESP:{
-                int responseResultIndex;
-                #ifdef GSM_DEBUG
-                    String error;
-                    String response;
-                #endif
-                if (_buffer.endsWith(GSM_OK)){
-                    _ready = 1;
-                    #ifdef GSM_DEBUG
-                        response = _buffer;
-                    #endif
-                }
-                else if (_buffer.endsWith(GSM_ERROR)){
-                    _ready = 2;
-                    #ifdef GSM_DEBUG
-                        response = _buffer;
-                    #endif
-                }
-                #ifdef GSM_DEBUG
-                else if (_buffer.endsWith(GSM_CME_ERROR)){
-                    streamSkipUntil('\n', &error);
-                    _ready = 3;
-                    response = GSM_CME_ERROR + error; 
+                //socket data can arrive while a command is pending (e.g. between pipelined sends)
+                if (c == ':'){
+                    checkChunkHeader();
+                    break;
                 }
-                else if (_buffer.endsWith(GSM_CMS_ERROR)){
-                    streamSkipUntil('\n', &error);
-                    _ready = 4;
-                    response = GSM_CMS_ERROR + error; 
+                if (c != '\n') break;
+                uint8_t code = resultCode();
+                if (code != 0){
+                    completeResponse(code);
                 }
-                #endif
-                if (_ready != 0){ 
-                    _lastResponseOrUrcMillis = millis();
-                    if (_lowPowerMode){ //after receiving the response, bring back low power mode if it were on
-                        digitalWrite(GSM_LOW_PWR_PIN, LOW);
+                else{
+                    ModemUrc urc = modemUrcLookup(_buffer + _lineStart, lineLength());
+                    if (modemUrcUnsolicited(urc, _buffer + _lineStart, lineLength())){
+                        //e.g. NMEA output keeps flowing during commands: hand it over, keep it out of the response
+                        dispatchUrc(urc);
+                        _bufferLen = _lineStart;
+                        _buffer[_bufferLen] = '\0';
                     }
-                    #ifdef GSM_DEBUG
-                    response.trim();
-                    DBG("#DEBUG# response received: \"", response, "\"");
-                    #endif
-                    if (_responseDataStorage != NULL){
-                        _buffer.trim();
-                        *_responseDataStorage = _buffer;
+                    else{
+                        _lineStart = _bufferLen; //keep the line as part of the response
                     }
-                    _buffer = ""; 
-                    _responseDataStorage = NULL;
-                    _atCommandState = AT_IDLE;
-                    break;
                 }
+                break;
             }
         } //end switch _atCommandState
     } //end while
+    processQueue();
 }
 
 void ModemClass::checkUrc()
 {
+    char last = _buffer[_bufferLen - 1];
     //############################################################################ +CIPRCV
-    if (_buffer.endsWith("+CIPRCV,")){
-        _sock = streamGetIntBefore(',');
-        _chunkLen = streamGetIntBefore(':');
-        _urcState = URC_RECV_SOCK_CHUNK;
-        _ready = 0;
-        _buffer = "";
+    if (last == ':'){
+        checkChunkHeader();
     }
     //############################################################################ UNHANDLED
-    else if(_buffer.endsWith("\r\n") && _buffer.length() > 2){
-        _lastResponseOrUrcMillis = millis();
-        #ifdef GSM_DEBUG
-        //can get URC not starting with \r\n+ but only with +
-        if (_buffer.startsWith("+") || _buffer.startsWith("\r\n+")){
-            //DBG("#DEBUG# sent: ", _sent);
-            _buffer.trim();
-            DBG("#DEBUG# unhandled URC received: \"", _buffer, "\"");
-        }
-        else {
-           // DBG("#DEBUG# sent: ", _sent);
-           _buffer.trim();
-           DBG("#DEBUG# unhandled data: \"", _buffer, "\"");
+    else if(last == '\n'){
+        if (_bufferLen - _lineStart > 2){
+            _lastResponseOrUrcMillis = millis();
+            if (dispatchUrc(modemUrcLookup(_buffer + _lineStart, lineLength()))){
+                clearBuffer();
+                return;
+            }
+            #ifdef GSM_DEBUG
+            //can get URC not starting with \r\n+ but only with +
+            char* line = trim(_buffer + _lineStart, _buffer + _bufferLen);
+            if (line[0] == '+'){
+                DBG("#DEBUG# unhandled URC received: \"", line, "\"");
+            }
+            else {
+                DBG("#DEBUG# unhandled data: \"", line, "\"");
+            }
+            #endif
         }
-        #endif
-        _buffer = "";
+        clearBuffer();
     }
     //############################################################################
 }
 
+//if the current line is a +CIPRCV,<mux>,<len>: header, switches to chunk reception
+bool ModemClass::checkChunkHeader()
+{
+    if (!lineStartsWith(URC_CIPRCV, sizeof(URC_CIPRCV) - 1)) return false;
+    const char* p = _buffer + _lineStart + sizeof(URC_CIPRCV) - 1;
+    uint16_t sock = parseDecimal(&p);
+    if (*p++ != ',') return false;
+    uint16_t len = parseDecimal(&p);
+    if (*p != ':') return false;
+    _chunkLen = len;
+    _sock = sock;
+    if (sock >= MAX_SOCKETS || _sockets[sock] == NULL){
+        DBG("#DEBUG# data received for unknown socket ", sock, ", discarding");
+        _sock = MAX_SOCKETS;
+    }
+    _urcState = _chunkLen > 0 ? URC_RECV_SOCK_CHUNK : URC_SKIP_CHUNK_END;
+    //while no command is pending, ready() reports busy until the chunk is complete, then the
+    //result it held before (e.g. the ERROR of a pipelined send not collected yet)
+    if (!commandPending()){
+        _chunkSavedReady = _ready;
+        _ready = 0;
+    }
+    //drop the header, keeping any response lines received before it
+    _bufferLen = _lineStart;
+    _buffer[_bufferLen] = '\0';
+    return true;
+}
+
+//current line without its terminator
+uint16_t ModemClass::lineLength() const
+{
+    uint16_t len = _bufferLen - _lineStart;
+    while (len > 0 && (_buffer[_lineStart + len - 1] == '\r' || _buffer[_lineStart + len - 1] == '\n')){
+        len--;
+    }
+    return len;
+}
+
+//hands the current line to the handlers subscribed to urc, in slot order
+bool ModemClass::dispatchUrc(ModemUrc urc)
+{
+    bool handled = false;
+    if (urc == MODEM_URC_CONNECT_OK || urc == MODEM_URC_CONNECT_FAIL || urc == MODEM_URC_SOCKET ||
+        urc == MODEM_URC_CLOSED || urc == MODEM_URC_CIPCLOSE || urc == MODEM_URC_PDP){
+        handled = socketReport(urc);
+    }
+    uint8_t routes = _urcRoutes[urc];
+    for (uint8_t i = 0; routes != 0; i++, routes >>= 1){
+        if (routes & 1){
+            _urcHandlers[i]->handleUrc(_buffer + _lineStart, lineLength());
+        }
+    }
+    return handled || _urcRoutes[urc] != 0;
+}
+
+/*Connection reports, routed to the socket they are about:
+    "CONNECT OK"/"CONNECT FAIL" settle the oldest pending connect, "<mux>, CONNECT OK" the one of mux;
+    "<mux>, CLOSED", "+CIPCLOSE: <mux>" (or a bare "CLOSED" with a single socket) end a connection
+    closed by the peer, "+PDP: DEACT" all of them
+*/
+bool ModemClass::socketReport(ModemUrc urc)
+{
+    int8_t mux = -1;
+    if (urc == MODEM_URC_SOCKET){
+        //"<mux>, <status>": the status is looked up as a line of its own
+        mux = _buffer[_lineStart] - '0';
+        urc = modemUrcLookup(_buffer + _lineStart + 3, lineLength() - 3);
+    }
+    else if (urc == MODEM_URC_CIPCLOSE){
+        const char* p = _buffer + _lineStart + sizeof("+CIPCLOSE") - 1;
+        while (*p == ':' || *p == ' ') p++;
+        mux = isdigit(*p) ? *p - '0' : -1;
+    }
+    switch (urc){
+        case MODEM_URC_CONNECT_OK:
+            return connectResult(mux, 1);
+        case MODEM_URC_CONNECT_FAIL:
+            return connectResult(mux, -1);
+        case MODEM_URC_CLOSED:
+        case MODEM_URC_CIPCLOSE:
+            return socketEnded(mux, true);
+        case MODEM_URC_PDP:{
+            if (strstr(_buffer + _lineStart, "DEACT") == NULL) return false;
+            bool ended = false;
+            for (uint8_t i = 0; i < MAX_SOCKETS; i++){
+                ended |= socketEnded(i, false);
+            }
+            return ended;
+        }
+        default:
+            return false;
+    }
+}
+
+//connection of mux (the only one open if -1) ended, closed by the peer or lost with the bearer
+bool ModemClass::socketEnded(int8_t mux, bool byPeer)
+{
+    GSM_Socket* socket = NULL;
+    if (mux >= 0){
+        socket = mux < MAX_SOCKETS ? _sockets[mux] : NULL;
+    }
+    else{
+        for (uint8_t i = 0; i < MAX_SOCKETS; i++){
+            if (_sockets[i] != NULL && _sockets[i]->connected()){
+                if (socket != NULL) return false; //ambiguous
+                socket = _sockets[i];
+            }
+        }
+    }
+    if (socket == NULL || !socket->connected()){
+        return false;
+    }
+    //a connect still pending has failed
+    socket->_state = byPeer && socket->_state == GSM_SOCKET_OPEN ? GSM_SOCKET_CLOSED : GSM_SOCKET_FAILED;
+    DBG("#DEBUG# socket ", socket->_mux, byPeer ? " closed by the peer" : " lost");
+    return true;
+}
+
+//result 1 connected, -1 failed
+bool ModemClass::connectResult(int8_t mux, int8_t result)
+{
+    GSM_Socket* socket = NULL;
+    if (mux >= 0){
+        socket = mux < MAX_SOCKETS ? _sockets[mux] : NULL;
+    }
+    else{
+        for (uint8_t i = 0; i < MAX_SOCKETS; i++){
+            GSM_Socket* candidate = _sockets[i];
+            if (candidate != NULL && candidate->_state == GSM_SOCKET_CONNECTING &&
+                (socket == NULL || millis() - candidate->_connectStart > millis() - socket->_connectStart)){
+                socket = candidate;
+            }
+        }
+    }
+    if (socket == NULL || socket->_state != GSM_SOCKET_CONNECTING){
+        if (!_connectInFlight){
+            DBG("#DEBUG# connect result without a pending connect");
+            return false;
+        }
+        //the CIPSTART being answered: kept until its +CIPNUM is parsed
+        _earlyConnect = result;
+        _earlyConnectMux = mux;
+        return true;
+    }
+    socket->_state = result > 0 ? GSM_SOCKET_OPEN : GSM_SOCKET_FAILED;
+    DBG("#DEBUG# socket ", socket->_mux, result > 0 ? " connected" : " connect failed");
+    return true;
+}
+
+void ModemClass::bufferPut(char c)
+{
+    if (_bufferLen == MODEM_BUFFER_SIZE && _lineStart > 0){
+        //response longer than the buffer: drop the lines already received, keep the current one
+        DBG("#DEBUG# modem buffer full, discarding ", _lineStart, " bytes");
+        memmove(_buffer, _buffer + _lineStart, _bufferLen - _lineStart);
+        _bufferLen -= _lineStart;
+        _lineStart = 0;
+    }
+    if (_bufferLen == MODEM_BUFFER_SIZE){
+        //single line longer than the buffer: truncate it but always keep its terminator
+        if (c != '\n') return;
+        _bufferLen--;
+    }
+    _buffer[_bufferLen++] = c;
+    _buffer[_bufferLen] = '\0';
+}
+
+void ModemClass::clearBuffer()
+{
+    _bufferLen = 0;
+    _lineStart = 0;
+    _buffer[0] = '\0';
+}
+
+bool ModemClass::lineStartsWith(const char* prefix, uint16_t len) const
+{
+    return (_bufferLen - _lineStart) >= len && memcmp(_buffer + _lineStart, prefix, len) == 0;
+}
+
+//result code terminating the response, given the last complete line: 0 if none
+uint8_t ModemClass::resultCode() const
+{
+    uint16_t len = _bufferLen - _lineStart;
+    const char* line = _buffer + _lineStart;
+    //GSM_OK and GSM_ERROR are framed by \r\n, the line only holds the trailing one
+    if (len == sizeof(GSM_OK) - 3 && memcmp(line, GSM_OK + 2, len) == 0){
+        return 1;
+    }
+    else if (len == sizeof(GSM_ERROR) - 3 && memcmp(line, GSM_ERROR + 2, len) == 0){
+        return 2;
+    }
+    else if (lineStartsWith(GSM_CME_ERROR, sizeof(GSM_CME_ERROR) - 1)){
+        return 3;
+    }
+    else if (lineStartsWith(GSM_CMS_ERROR, sizeof(GSM_CMS_ERROR) - 1)){
+        return 4;
+    }
+    return 0;
+}
+
+void ModemClass::completeResponse(uint8_t code)
+{
+    MODEM_STATS(result(code));
+    _ready = code;
+    _lastResponseOrUrcMillis = millis();
+    if (_lowPowerMode){ //after receiving the response, bring back low power mode if it were on
+        digitalWrite(GSM_LOW_PWR_PIN, LOW);
+    }
+    char* response = trim(_buffer, _buffer + _bufferLen);
+    DBG("#DEBUG# response received: \"", response, "\"");
+    if (_responseDataStorage != NULL){
+        //copied into the arena slot of the caller: the buffer is reused by the next line
+        char* slot = _responseArena;
+        uint16_t size = MODEM_RESPONSE_SIZE;
+        if (_responseSlot > 0){
+            slot += MODEM_RESPONSE_SIZE + 1 + (_responseSlot - 1) * (MODEM_QUEUE_RESPONSE_SIZE + 1);
+            size = MODEM_QUEUE_RESPONSE_SIZE;
+        }
+        uint16_t len = strlen(response);
+        if (len > size){
+            DBG("#DEBUG# response truncated to ", size, " bytes");
+            len = size;
+        }
+        memcpy(slot, response, len);
+        slot[len] = '\0';
+        *_responseDataStorage = ModemResponse(slot, len);
+    }
+    clearBuffer();
+    _responseDataStorage = NULL;
+    _atCommandState = AT_IDLE;
+}
+
 inline int16_t ModemClass::streamGetIntBefore(const char& lastChar)
 {
     char buf[7];
@@ -400,7 +922,7 @@ inline bool ModemClass::streamSkipUntil(const char& c, String* save, const uint3
     uint32_t startMillis = millis();
     while (millis() - startMillis < timeout_ms){
         while (_uart->available()){
-            char r = _uart->read();
+            char r = readUart();
             //DBG("#DEBUG#", r);
             if (save != NULL) *save += r; 
             if (r == c) return true;
@@ -414,14 +936,40 @@ void ModemClass::setBaudRate(unsigned long baud)
     _baud = baud;
 }
 
-void ModemClass::addUrcHandler(ModemUrcHandler* handler)
+//slot of handler, allocated on first use; -1 if all are taken
+int8_t ModemClass::urcSlot(ModemUrcHandler* handler)
 {
-    for (int i = 0; i < MAX_URC_HANDLERS; i++) {
-        if (_urcHandlers[i] == NULL) {
-            _urcHandlers[i] = handler;
-            break;
+    int8_t slot = -1;
+    for (int8_t i = 0; i < MAX_URC_HANDLERS; i++) {
+        if (_urcHandlers[i] == handler) {
+            return i;
+        }
+        if (_urcHandlers[i] == NULL && slot < 0) {
+            slot = i;
         }
     }
+    if (slot >= 0) {
+        _urcHandlers[slot] = handler;
+    }
+    return slot;
+}
+
+bool ModemClass::addUrcHandler(ModemUrcHandler* handler, ModemUrc urc)
+{
+    int8_t slot = urcSlot(handler);
+    if (slot < 0 || urc > MODEM_URC_UNKNOWN) return false;
+    _urcRoutes[urc] |= 1 << slot;
+    return true;
+}
+
+bool ModemClass::addUrcHandler(ModemUrcHandler* handler)
+{
+    int8_t slot = urcSlot(handler);
+    if (slot < 0) return false;
+    for (int i = 0; i <= MODEM_URC_UNKNOWN; i++) {
+        _urcRoutes[i] |= 1 << slot;
+    }
+    return true;
 }
 
 void ModemClass::removeUrcHandler(ModemUrcHandler* handler)
@@ -429,6 +977,9 @@ void ModemClass::removeUrcHandler(ModemUrcHandler* handler)
     for (int i = 0; i < MAX_URC_HANDLERS; i++) {
         if (_urcHandlers[i] == handler) {
             _urcHandlers[i] = NULL;
+            for (int j = 0; j <= MODEM_URC_UNKNOWN; j++) {
+                _urcRoutes[j] &= ~(1 << i);
+            }
             break;
         }
     }
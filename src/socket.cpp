@@ -1,72 +1,160 @@
 #include "socket.h"
 
-GSM_Socket::GSM_Socket(uint8_t mux):
+#ifndef MODEM_NO_STATS
+#define SOCKET_STATS(call) MODEM._stats.call
+#else
+#define SOCKET_STATS(call)
+#endif
+
+//one socket per mux, allocated once: opening and closing connections does not touch the heap
+struct GSM_SocketPool {
+    static_assert(MAX_SOCKETS == 3, "one pool slot per mux");
+    GSM_BufferedSocket<GSM_SOCKET0_BUFFER_SIZE> socket0{0};
+    GSM_BufferedSocket<GSM_SOCKET1_BUFFER_SIZE> socket1{1};
+    GSM_BufferedSocket<GSM_SOCKET2_BUFFER_SIZE> socket2{2};
+};
+
+static GSM_SocketPool pool;
+
+uint32_t GSM_Socket::poolBytes()
+{
+    return sizeof(pool);
+}
+
+GSM_Socket::GSM_Socket(uint8_t mux, uint8_t* buffer, uint16_t size):
     _mux(mux),
-    _freeIndex(0),
-    _free(BUFFER_MAX)
+    _generation(0),
+    _state(GSM_SOCKET_OPEN),
+    _connectStart(0),
+    _connectTimeout(0),
+    _buffer(buffer),
+    _mask(size - 1),
+    _head(0),
+    _tail(0),
+    _dropped(0),
+    _failedSends(0)
+{
+}
+
+GSM_Socket* GSM_Socket::acquire(uint8_t mux)
 {
+    GSM_Socket* socket;
+    switch (mux){
+        case 0: socket = &pool.socket0; break;
+        case 1: socket = &pool.socket1; break;
+        case 2: socket = &pool.socket2; break;
+        default: return NULL;
+    }
+    if (++socket->_generation > 0xFF >> GSM_SOCKET_MUX_BITS){
+        socket->_generation = 1;
+    }
+    socket->_state = GSM_SOCKET_OPEN;
+    socket->_connectStart = 0;
+    socket->_connectTimeout = 0;
+    socket->_head = 0;
+    socket->_tail = 0;
+    socket->_dropped = 0;
+    socket->_failedSends = 0;
+    return socket;
 }
 
-void GSM_Socket::handleUrc(const void* urc, uint16_t len)
-{		
-    const uint8_t * urcB = reinterpret_cast<const uint8_t*>(urc);
-    if (_free < len){
-        DBG("#DEBUG# TCP buffer %d overflow! Discarding new bytes, sock ", _mux);
-        for(int i = 0; i < _free; i++){
-            _buffer[_freeIndex] = urcB[i];
-            _freeIndex = (_freeIndex + 1) % BUFFER_MAX;
-        }
-        _free = 0;
+//moves len bytes of a +CIPRCV chunk from the modem uart into the buffer, without per byte dispatch
+uint16_t GSM_Socket::receive(ModemClass& modem, uint16_t len)
+{
+    uint16_t stored = min(len, (uint16_t) (_mask + 1 - available()));
+    if (stored < len){
+        DBG("#DEBUG# TCP buffer overflow! Discarding new bytes, sock ", _mux);
+        _dropped += len - stored;
+    }
+    //copy in at most two contiguous runs: up to the end of the buffer, then from its start
+    uint16_t start = _head & _mask;
+    uint16_t run = min(stored, (uint16_t) (_mask + 1 - start));
+    uint8_t* dst = _buffer + start;
+    for (uint16_t i = 0; i < run; i++){
+        dst[i] = modem.readUart();
+    }
+    for (uint16_t i = run; i < stored; i++){
+        _buffer[i - run] = modem.readUart();
     }
-    else{
-        for(int i = 0; i < len; i++){
-            _buffer[_freeIndex] = urcB[i];
-            _freeIndex = (_freeIndex + 1) % BUFFER_MAX;
-        }
-        _free -= len;
+    _head += stored;
+    SOCKET_STATS(received(_mux, stored, len - stored));
+    for (uint16_t i = stored; i < len; i++){
+        modem.readUart();
     }
+    return stored;
 }
 
-uint16_t GSM_Socket::read(void* buf, uint16_t len, unsigned long timeout) //TODO implement read that returns -1 when other end closes the connection
+//received bytes as at most two contiguous spans, readable in place until consume()
+uint8_t GSM_Socket::peek(GSM_Span spans[2]) const
+{
+    uint16_t len = available();
+    if (len == 0) return 0;
+    uint16_t start = _tail & _mask;
+    uint16_t run = min(len, (uint16_t) (_mask + 1 - start));
+    spans[0].data = _buffer + start;
+    spans[0].len = run;
+    if (run == len) return 1;
+    spans[1].data = _buffer;
+    spans[1].len = len - run;
+    return 2;
+}
+
+void GSM_Socket::consume(uint16_t len)
+{
+    _tail += min(len, available());
+}
+
+uint16_t GSM_Socket::copyOut(uint8_t* dst, uint16_t len)
+{
+    GSM_Span spans[2];
+    uint8_t count = peek(spans);
+    uint16_t copied = 0;
+    for (uint8_t i = 0; i < count && copied < len; i++){
+        uint16_t n = min(spans[i].len, (uint16_t) (len - copied));
+        memcpy(dst + copied, spans[i].data, n);
+        copied += n;
+    }
+    consume(copied);
+    return copied;
+}
+
+//returns as soon as minLen bytes (at most len) have been read, when timeout expires, or when the
+//connection ends; -1 once it has ended and all the data received before has been read
+int GSM_Socket::read(void* buf, uint16_t len, unsigned long timeout, uint16_t minLen)
 {
     uint8_t* bufB = reinterpret_cast<uint8_t*>(buf);
-    uint16_t readIndex = (_freeIndex + _free) % BUFFER_MAX;
-    if (BUFFER_MAX - _free >= len){
-        for(int i = 0; i < len; i++){
-            bufB[i] = _buffer[readIndex];
-            readIndex = (readIndex + 1) % BUFFER_MAX;
-        }
-        _free += len;
-        return len;
+    minLen = min(minLen, len);
+    uint16_t done = copyOut(bufB, len);
+    for (unsigned long start = millis(); done < minLen && connected() && (millis() - start) < timeout;){
+        MODEM.poll(); //let the modem read other expected data from the stream
+        done += copyOut(bufB + done, len - done);
     }
-    else{
-        uint16_t len_r = len;
-        for (unsigned long start = millis(); (millis() - start) < timeout && len_r > 0;){
-            uint16_t readNow = min(len_r, BUFFER_MAX - _free);
-            for(int i = 0; i < readNow; i++){
-                bufB[i] = _buffer[readIndex];
-                readIndex = (readIndex + 1) % BUFFER_MAX;
-            }
-            _free += readNow;
-            len_r -= readNow;
-            delay(100);
-            MODEM.poll(); //let the modem read other expected data from the stream
-        }
-        return len - len_r;
+    if (done == 0 && !connected()){
+        return -1;
     }
+    return done;
 }
 
-uint16_t GSM_Socket::send(const void* buff, uint16_t len) 
+uint16_t GSM_Socket::send(const void* buff, uint16_t len, bool wait)
 {
-    //String prompt(PROMPT);
-    if (!MODEM.turnEcho(false)) return 0;
-    MODEM.sendf("AT+CIPSEND=%d,%d", _mux, (uint16_t) len); 
-    MODEM._atCommandState = ModemClass::AT_RECV_RESP;
+    //echo is turned off once and stays off while sockets are open (see GPRS::close),
+    //so every packet costs a single CIPSEND exchange
+    if (MODEM._echo && !MODEM.turnEcho(false)) return 0;
+    MODEM.send("AT+CIPSEND=", _mux, ',', len);
     MODEM.write(reinterpret_cast<const uint8_t*>(buff), len);
     MODEM.write(0x1A); //tell modem to send
     MODEM.flush();
-    uint8_t resp = MODEM.waitForResponse(60 * 1000); //OK if successfull; what if fail? TODO
-    if (resp != 1) return 0;
-    MODEM.turnEcho(true);
+    if (!wait){
+        //pipelined: the result is collected (and the bytes counted) before the next command is issued
+        MODEM._sendPending = this;
+        MODEM._sendPendingLen = len;
+        return len;
+    }
+    int resp = MODEM.waitForResponse(MODEM_SEND_TIMEOUT_MS);
+    if (resp != 1){
+        _failedSends++;
+        return 0;
+    }
+    SOCKET_STATS(sent(_mux, len));
     return len;
 }